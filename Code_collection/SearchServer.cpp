@@ -1,59 +1,330 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <deque>
+#include <exception>
+#include <execution>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <list>
 #include <optional>
 #include <set>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <sstream>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <numeric>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define SEARCH_SERVER_X86_SIMD
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 
 const double EPSILON = 1e-6;
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const char FIRST_SPECIAL_SYMBOL = 0;
 const char LAST_SPECIAL_SYMBOL = 31;
+const char SNAPSHOT_MAGIC[4] = { 'S', 'S', 'I', 'X' };
+const uint32_t SNAPSHOT_VERSION = 1;
+const size_t SCRATCH_BUFFER_SIZE = 4096;
+const size_t PRUNING_MAX_TOP_K = 100;
+const size_t PRUNING_MAX_PLUS_WORDS = 5;
+//номера отбираются по списку затронутых запросом, если их меньше 1/DENSE_SCAN_RATIO всех номеров, иначе сплошным проходом
+const size_t DENSE_SCAN_RATIO = 8;
+const size_t TOKENIZER_BLOCK_SIZE = 64;
+
+//LOG_DURATION("имя") замеряет время до конца текущего блока и печатает его в cerr,
+//LOG_DURATION_STREAM("имя", поток) - в указанный поток
+#define PROFILE_CONCAT_INTERNAL(X, Y) X##Y
+#define PROFILE_CONCAT(X, Y) PROFILE_CONCAT_INTERNAL(X, Y)
+#define UNIQUE_VAR_NAME_PROFILE PROFILE_CONCAT(profile_guard_, __LINE__)
+#define LOG_DURATION(x) LogDuration UNIQUE_VAR_NAME_PROFILE(x)
+#define LOG_DURATION_STREAM(x, y) LogDuration UNIQUE_VAR_NAME_PROFILE(x, y)
+
+class LogDuration {
+public:
+    using Clock = chrono::steady_clock;
 
-string ReadLine() {
-    string s;
-    getline(cin, s);
-    return s;
-}
+    explicit LogDuration(string_view operation, ostream& out = cerr)
+        : operation_(operation)
+        , out_(out) {
+    }
 
-int ReadLineWithNumber() {
-    int result = 0;
-    cin >> result;
-    ReadLine();
-    return result;
-}
+    ~LogDuration() {
+        const auto duration = Clock::now() - start_time_;
+        out_ << operation_ << ": "s << chrono::duration_cast<chrono::milliseconds>(duration).count() << " ms"s << endl;
+    }
+
+private:
+    const string operation_;
+    ostream& out_;
+    const Clock::time_point start_time_ = Clock::now();
+};
+
+//гистограмма длительностей: корзина i считает замеры из [2^i, 2^(i+1)) наносекунд. Счетчики атомарные,
+//замеры можно добавлять из нескольких потоков
+class DurationHistogram {
+public:
+    static const size_t BUCKET_COUNT = 40;
+
+    void Add(chrono::nanoseconds duration) {
+        const uint64_t nanoseconds = static_cast<uint64_t>(max<int64_t>(duration.count(), 1));
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKET_COUNT && (nanoseconds >> (bucket + 1)) != 0) {
+            ++bucket;
+        }
+        buckets_[bucket].fetch_add(1, memory_order_relaxed);
+        count_.fetch_add(1, memory_order_relaxed);
+        total_nanoseconds_.fetch_add(nanoseconds, memory_order_relaxed);
+    }
 
-vector<string> SplitIntoWords(const string& text) {
-    vector<string> words;
-    string word;
+    uint64_t GetCount() const {
+        return count_.load(memory_order_relaxed);
+    }
+
+    chrono::nanoseconds GetTotal() const {
+        return chrono::nanoseconds(total_nanoseconds_.load(memory_order_relaxed));
+    }
 
-    for (const char c : text) {
-        if (c == ' ') {
-            if (!word.empty()) {
-                words.push_back(word);
-                word.clear();
+    //верхняя граница корзины, в которую попадает доля share замеров
+    chrono::nanoseconds GetPercentile(double share) const {
+        const uint64_t count = GetCount();
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            seen += buckets_[bucket].load(memory_order_relaxed);
+            if (count > 0 && seen >= share * count) {
+                return chrono::nanoseconds(uint64_t{ 2 } << bucket);
             }
         }
-        else if (c >= FIRST_SPECIAL_SYMBOL && c <= LAST_SPECIAL_SYMBOL) {
-            throw invalid_argument("Invalid char in query/stop words");
+        return chrono::nanoseconds(0);
+    }
+
+    void Reset() {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, memory_order_relaxed);
         }
-        else {
-            word += c;
+        count_.store(0, memory_order_relaxed);
+        total_nanoseconds_.store(0, memory_order_relaxed);
+    }
+
+private:
+    array<atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+    atomic<uint64_t> count_{ 0 };
+    atomic<uint64_t> total_nanoseconds_{ 0 };
+};
+
+//этапы поиска: разбор запроса, подсчет релевантности по posting list, отбор документов фильтром
+//(вместе с кучей лучших top_k) и сортировка результата
+enum class QueryStage {
+    PARSE,
+    SCORE,
+    FILTER,
+    SORT,
+};
+
+const size_t QUERY_STAGE_COUNT = 4;
+const string_view QUERY_STAGE_NAMES[QUERY_STAGE_COUNT] = { "parse"sv, "score"sv, "filter"sv, "sort"sv };
+
+struct QueryProfile {
+    array<DurationHistogram, QUERY_STAGE_COUNT> stages;
+
+    const DurationHistogram& operator[](QueryStage stage) const {
+        return stages[static_cast<size_t>(stage)];
+    }
+
+    void Reset() {
+        for (auto& stage : stages) {
+            stage.Reset();
+        }
+    }
+
+    void Print(ostream& out) const {
+        for (size_t stage = 0; stage < QUERY_STAGE_COUNT; ++stage) {
+            const auto& histogram = stages[stage];
+            out << QUERY_STAGE_NAMES[stage] << ": count "s << histogram.GetCount() << ", total "s
+                << chrono::duration_cast<chrono::microseconds>(histogram.GetTotal()).count() << " us, p50 <= "s
+                << histogram.GetPercentile(0.5).count() << " ns, p99 <= "s << histogram.GetPercentile(0.99).count() << " ns"s << endl;
         }
     }
+};
+
+//замер этапа до конца блока, результат идет в гистограмму
+class StageTimer {
+public:
+    explicit StageTimer(DurationHistogram& histogram)
+        : histogram_(histogram) {
+    }
+
+    ~StageTimer() {
+        histogram_.Add(chrono::steady_clock::now() - start_time_);
+    }
+
+private:
+    DurationHistogram& histogram_;
+    const chrono::steady_clock::time_point start_time_ = chrono::steady_clock::now();
+};
+
+//замеры этапов поиска включаются при компиляции с -DSEARCH_SERVER_PROFILE, без него макрос пустой
+#ifdef SEARCH_SERVER_PROFILE
+#define PROFILE_QUERY_STAGE(stage) StageTimer UNIQUE_VAR_NAME_PROFILE(query_profile_->stages[static_cast<size_t>(stage)])
+#else
+#define PROFILE_QUERY_STAGE(stage)
+#endif
+
+//разметка блока из TOKENIZER_BLOCK_SIZE байт текста: бит i выставлен, если байт i - пробел (spaces)
+//или управляющий символ FIRST_SPECIAL_SYMBOL..LAST_SPECIAL_SYMBOL (specials)
+struct BlockMasks {
+    uint64_t spaces = 0;
+    uint64_t specials = 0;
+};
+
+using ScanBlockFunc = BlockMasks(*)(const char* data);
+
+static_assert(FIRST_SPECIAL_SYMBOL == 0, "SIMD scan checks only the upper bound of special symbols");
+
+BlockMasks ScanBlockScalar(const char* data) {
+    BlockMasks masks;
+    for (size_t i = 0; i < TOKENIZER_BLOCK_SIZE; ++i) {
+        const auto c = static_cast<unsigned char>(data[i]);
+        masks.spaces |= static_cast<uint64_t>(c == ' ') << i;
+        masks.specials |= static_cast<uint64_t>(c <= static_cast<unsigned char>(LAST_SPECIAL_SYMBOL)) << i;
+    }
+    return masks;
+}
+
+#ifdef SEARCH_SERVER_X86_SIMD
+//SSE2 есть на любом x86-64, блок разбирается по 16 байт
+BlockMasks ScanBlockSse2(const char* data) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i last_special = _mm_set1_epi8(LAST_SPECIAL_SYMBOL);
+    BlockMasks masks;
+    for (size_t offset = 0; offset < TOKENIZER_BLOCK_SIZE; offset += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+        //байты сравниваются без знака: c <= 31 ровно тогда, когда min(c, 31) == c
+        const __m128i specials = _mm_cmpeq_epi8(_mm_min_epu8(chunk, last_special), chunk);
+        masks.spaces |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, space)))) << offset;
+        masks.specials |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(specials))) << offset;
+    }
+    return masks;
+}
+
+//AVX2 - по 32 байта, собирается для любого x86-64 и вызывается, только если процессор его поддерживает
+__attribute__((target("avx2")))
+BlockMasks ScanBlockAvx2(const char* data) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i last_special = _mm256_set1_epi8(LAST_SPECIAL_SYMBOL);
+    BlockMasks masks;
+    for (size_t offset = 0; offset < TOKENIZER_BLOCK_SIZE; offset += 32) {
+        const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset));
+        const __m256i specials = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, last_special), chunk);
+        masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, space)))) << offset;
+        masks.specials |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(specials))) << offset;
+    }
+    return masks;
+}
+#endif
+
+//лучшая разметка блока для текущего процессора, выбирается один раз
+ScanBlockFunc GetScanBlock() {
+    static const ScanBlockFunc scan_block = [] {
+#ifdef SEARCH_SERVER_X86_SIMD
+        return __builtin_cpu_supports("avx2") ? ScanBlockAvx2 : ScanBlockSse2;
+#else
+        return ScanBlockScalar;
+#endif
+    }();
+    return scan_block;
+}
+
+int CountTrailingZeros(uint64_t mask) {
+#ifdef __GNUC__
+    return __builtin_ctzll(mask);
+#else
+    int count = 0;
+    for (; (mask & 1) == 0; mask >>= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+//вызывает func(block_begin, masks) для каждого блока текста, хвост короче блока дополняется буквами
+template <typename Func>
+void ForEachTextBlock(string_view text, ScanBlockFunc scan_block, Func func) {
+    size_t block_begin = 0;
+    for (; block_begin + TOKENIZER_BLOCK_SIZE <= text.size(); block_begin += TOKENIZER_BLOCK_SIZE) {
+        func(block_begin, scan_block(text.data() + block_begin));
+    }
+    if (block_begin < text.size()) {
+        array<char, TOKENIZER_BLOCK_SIZE> tail;
+        tail.fill('a');
+        memcpy(tail.data(), text.data() + block_begin, text.size() - block_begin);
+        func(block_begin, scan_block(tail.data()));
+    }
+}
+
+//true, если в тексте есть управляющий символ
+bool HasSpecialSymbol(string_view text, ScanBlockFunc scan_block = GetScanBlock()) {
+    uint64_t specials = 0;
+    ForEachTextBlock(text, scan_block, [&specials](size_t, BlockMasks masks) {
+        specials |= masks.specials;
+        });
+    return specials != 0;
+}
+
+//слова добавляются в words как string_view в исходный текст, text должен пережить результат.
+//Words - vector<string_view> или pmr::vector<string_view> из временной памяти запроса.
+//Границы слов ищутся сразу по 64 байта, scan_block по умолчанию - SIMD-разметка из GetScanBlock
+template <typename Words>
+void SplitIntoWords(string_view text, Words& words, ScanBlockFunc scan_block = GetScanBlock()) {
+    size_t word_begin = 0;
+
+    ForEachTextBlock(text, scan_block, [&](size_t block_begin, BlockMasks masks) {
+        if (masks.specials != 0) {
+            throw invalid_argument("Invalid char in query/stop words");
+        }
+        for (uint64_t spaces = masks.spaces; spaces != 0; spaces &= spaces - 1) {
+            const size_t i = block_begin + CountTrailingZeros(spaces);
+            if (i > word_begin) {
+                words.push_back(text.substr(word_begin, i - word_begin));
+            }
+            word_begin = i + 1;
+        }
+        });
 
-    if (!word.empty()) {
-        words.push_back(word);
+    if (word_begin < text.size()) {
+        words.push_back(text.substr(word_begin));
     }
+}
 
+vector<string_view> SplitIntoWords(string_view text) {
+    vector<string_view> words;
+    SplitIntoWords(text, words);
     return words;
 }
 
@@ -70,226 +341,2085 @@ struct Document {
     int rating = 0;
 };
 
+//документ для пакетного добавления, text должен быть жив до конца AddDocuments
+struct RawDocument {
+    int id = 0;
+    string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    vector<int> ratings;
+};
+
+//слова запроса отсортированы и без повторов, string_view указывают в текст запроса
+//вектора выделяются из временной памяти запроса, см. ParseQuery.
+//required - слова, которые обязаны быть в документе (+слово и слова фраз в кавычках), они же входят в plus
 struct Query {
-    set<string> plus;
-    set<string> minus;
+    pmr::vector<string_view> plus;
+    pmr::vector<string_view> minus;
+    pmr::vector<string_view> required;
+};
+
+//map, разбитый на bucket_count частей по ключу, у каждой части свой mutex.
+//Потоки, пишущие в разные части, не мешают друг другу
+template <typename Key, typename Value>
+class ConcurrentMap {
+public:
+    static_assert(is_integral_v<Key>, "ConcurrentMap supports only integer keys");
+
+    struct Access {
+        lock_guard<mutex> guard;
+        Value& ref_to_value;
+    };
+
+    explicit ConcurrentMap(size_t bucket_count)
+        : buckets_(bucket_count) {
+    }
+
+    Access operator[](const Key& key) {
+        Bucket& bucket = GetBucket(key);
+        return { lock_guard(bucket.guard), bucket.values[key] };
+    }
+
+    void erase(const Key& key) {
+        Bucket& bucket = GetBucket(key);
+        lock_guard guard(bucket.guard);
+        bucket.values.erase(key);
+    }
+
+    map<Key, Value> BuildOrdinaryMap() {
+        map<Key, Value> result;
+        for (auto& bucket : buckets_) {
+            lock_guard guard(bucket.guard);
+            result.insert(bucket.values.begin(), bucket.values.end());
+        }
+        return result;
+    }
+
+private:
+    struct Bucket {
+        mutex guard;
+        map<Key, Value> values;
+    };
+
+    Bucket& GetBucket(const Key& key) {
+        return buckets_[static_cast<make_unsigned_t<Key>>(key) % buckets_.size()];
+    }
+
+    vector<Bucket> buckets_;
+};
+
+//запись снимка индекса: числа пишутся как есть (порядок байт машины), строки и векторы - размером и содержимым
+class BinaryWriter {
+public:
+    explicit BinaryWriter(ostream& out)
+        : out_(out) {
+    }
+
+    template <typename T>
+    void Write(const T& value) {
+        static_assert(is_trivially_copyable_v<T>);
+        out_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void WriteString(string_view text) {
+        Write(static_cast<uint64_t>(text.size()));
+        out_.write(text.data(), text.size());
+    }
+
+    template <typename T>
+    void WriteVector(const vector<T>& values) {
+        static_assert(is_trivially_copyable_v<T>);
+        Write(static_cast<uint64_t>(values.size()));
+        out_.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+private:
+    ostream& out_;
+};
+
+//чтение снимка прямо из памяти (отображенного файла), выход за границы - исключение
+class BinaryReader {
+public:
+    BinaryReader(const char* begin, const char* end)
+        : position_(begin)
+        , end_(end) {
+    }
+
+    template <typename T>
+    T Read() {
+        static_assert(is_trivially_copyable_v<T>);
+        T value;
+        memcpy(&value, Take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    string_view ReadString() {
+        const size_t size = Read<uint64_t>();
+        return { Take(size), size };
+    }
+
+    template <typename T>
+    void ReadVector(vector<T>& values) {
+        static_assert(is_trivially_copyable_v<T>);
+        const size_t size = Read<uint64_t>();
+        if (size > static_cast<size_t>(end_ - position_) / sizeof(T)) {
+            throw invalid_argument("Corrupted index snapshot");
+        }
+        values.resize(size);
+        if (size > 0) {
+            memcpy(values.data(), Take(size * sizeof(T)), size * sizeof(T));
+        }
+    }
+
+private:
+    const char* position_;
+    const char* end_;
+
+    const char* Take(size_t size) {
+        if (size > static_cast<size_t>(end_ - position_)) {
+            throw invalid_argument("Corrupted index snapshot");
+        }
+        const char* result = position_;
+        position_ += size;
+        return result;
+    }
+};
+
+//файл, отображенный в память только для чтения. Там, где нет mmap, файл читается целиком
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Can't open file " + path);
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            close(fd);
+            throw runtime_error("Can't stat file " + path);
+        }
+        size_ = static_cast<size_t>(file_stat.st_size);
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("Can't map file " + path);
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        close(fd);
+#else
+        ifstream in(path, ios::binary);
+        if (!in) {
+            throw runtime_error("Can't open file " + path);
+        }
+        buffer_.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    const char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#if !(defined(__unix__) || defined(__APPLE__))
+    vector<char> buffer_;
+#endif
+};
+
+//сжатый posting list: записи {номер документа, сколько раз слово встречается в документе} разбиты на блоки
+//по BLOCK_SIZE. Номер первой записи блока хранится в заголовке, остальные - разностью с предыдущей,
+//разности и количества записаны varint. По заголовкам (номер последней записи) блоки пропускаются без распаковки
+class CompressedPostingList {
+public:
+    static const size_t BLOCK_SIZE = 128;
+
+    class Cursor {
+    public:
+        explicit Cursor(const CompressedPostingList& posting_list)
+            : posting_list_(&posting_list) {
+            LoadBlock(0);
+        }
+
+        bool AtEnd() const {
+            return block_ >= posting_list_->blocks_.size();
+        }
+
+        int Ordinal() const {
+            return ordinals_[position_];
+        }
+
+        int Count() const {
+            return counts_[position_];
+        }
+
+        void Next() {
+            if (++position_ == block_size_) {
+                LoadBlock(block_ + 1);
+            }
+        }
+
+        //переход к первой записи с номером >= ordinal
+        void SkipTo(int ordinal) {
+            if (AtEnd() || Ordinal() >= ordinal) {
+                return;
+            }
+            size_t block = block_;
+            while (block < posting_list_->blocks_.size() && posting_list_->blocks_[block].last_ordinal < ordinal) {
+                ++block;
+            }
+            if (block != block_) {
+                LoadBlock(block);
+                if (AtEnd()) {
+                    return;
+                }
+            }
+            position_ = lower_bound(ordinals_, ordinals_ + block_size_, ordinal) - ordinals_;
+        }
+
+    private:
+        const CompressedPostingList* posting_list_;
+        size_t block_ = 0;
+        size_t block_size_ = 0;
+        size_t position_ = 0;
+        int ordinals_[BLOCK_SIZE];
+        int counts_[BLOCK_SIZE];
+
+        void LoadBlock(size_t block) {
+            block_ = block;
+            position_ = 0;
+            block_size_ = 0;
+            if (!AtEnd()) {
+                posting_list_->ForEachInBlock(block, [this](int ordinal, int count) {
+                    ordinals_[block_size_] = ordinal;
+                    counts_[block_size_] = count;
+                    ++block_size_;
+                    });
+            }
+        }
+    };
+
+    //номера должны добавляться по возрастанию
+    void PushBack(int ordinal, int count) {
+        if (blocks_.empty() || blocks_.back().size == BLOCK_SIZE) {
+            blocks_.push_back({ ordinal, ordinal, static_cast<uint32_t>(bytes_.size()), 0 });
+        }
+        else {
+            WriteVarint(static_cast<uint32_t>(ordinal - blocks_.back().last_ordinal));
+        }
+        WriteVarint(static_cast<uint32_t>(count));
+        blocks_.back().last_ordinal = ordinal;
+        ++blocks_.back().size;
+        ++size_;
+    }
+
+    template <typename Predicate>
+    void RemoveIf(Predicate predicate) {
+        CompressedPostingList result;
+        ForEach([&result, &predicate](int ordinal, int count) {
+            if (!predicate(ordinal)) {
+                result.PushBack(ordinal, count);
+            }
+            });
+        *this = move(result);
+    }
+
+    template <typename Func>
+    void ForEach(Func func) const {
+        for (size_t block = 0; block < blocks_.size(); ++block) {
+            ForEachInBlock(block, func);
+        }
+    }
+
+    template <typename Func>
+    void ForEachInBlock(size_t block, Func func) const {
+        const Block& header = blocks_[block];
+        const uint8_t* data = bytes_.data() + header.offset;
+        int ordinal = header.first_ordinal;
+        for (uint32_t i = 0; i < header.size; ++i) {
+            if (i > 0) {
+                ordinal += static_cast<int>(ReadVarint(data));
+            }
+            func(ordinal, static_cast<int>(ReadVarint(data)));
+        }
+    }
+
+    //записи с номерами из [first, last): блоки, целиком лежащие вне диапазона, не распаковываются
+    template <typename Func>
+    void ForEachInRange(int first, int last, Func func) const {
+        auto block_it = lower_bound(blocks_.begin(), blocks_.end(), first, [](const Block& block, int ordinal) {
+            return block.last_ordinal < ordinal;
+            });
+        for (; block_it != blocks_.end() && block_it->first_ordinal < last; ++block_it) {
+            ForEachInBlock(block_it - blocks_.begin(), [first, last, &func](int ordinal, int count) {
+                if (ordinal >= first && ordinal < last) {
+                    func(ordinal, count);
+                }
+                });
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t BlockCount() const {
+        return blocks_.size();
+    }
+
+    size_t MemoryUsage() const {
+        return bytes_.capacity() + blocks_.capacity() * sizeof(Block);
+    }
+
+    void ShrinkToFit() {
+        bytes_.shrink_to_fit();
+        blocks_.shrink_to_fit();
+    }
+
+    void Save(BinaryWriter& writer) const {
+        writer.Write(static_cast<uint64_t>(size_));
+        writer.WriteVector(blocks_);
+        writer.WriteVector(bytes_);
+    }
+
+    //заголовки и байты блоков из файла проверяются целиком: после Load список можно читать без проверок границ
+    void Load(BinaryReader& reader) {
+        size_ = reader.Read<uint64_t>();
+        reader.ReadVector(blocks_);
+        reader.ReadVector(bytes_);
+
+        size_t total_size = 0;
+        for (size_t block = 0; block < blocks_.size(); ++block) {
+            const Block& header = blocks_[block];
+            const size_t block_end = block + 1 < blocks_.size() ? blocks_[block + 1].offset : bytes_.size();
+            if (header.size == 0 || header.size > BLOCK_SIZE || header.first_ordinal < 0
+                || header.first_ordinal > header.last_ordinal
+                || (block == 0 ? header.offset != 0 : header.first_ordinal <= blocks_[block - 1].last_ordinal)
+                || header.offset >= block_end || block_end > bytes_.size()) {
+                throw invalid_argument("Corrupted posting list block");
+            }
+            //номера внутри блока строго возрастают и заканчиваются на last_ordinal, байты блока читаются ровно до конца
+            const uint8_t* data = bytes_.data() + header.offset;
+            const uint8_t* const end = bytes_.data() + block_end;
+            int ordinal = header.first_ordinal;
+            for (uint32_t i = 0; i < header.size; ++i) {
+                if (i > 0) {
+                    const uint32_t delta = ReadVarint(data, end);
+                    if (delta == 0 || delta > static_cast<uint32_t>(header.last_ordinal - ordinal)) {
+                        throw invalid_argument("Corrupted posting list block");
+                    }
+                    ordinal += static_cast<int>(delta);
+                }
+                if (ReadVarint(data, end) == 0) {
+                    throw invalid_argument("Corrupted posting list block");
+                }
+            }
+            if (ordinal != header.last_ordinal || data != end) {
+                throw invalid_argument("Corrupted posting list block");
+            }
+            total_size += header.size;
+        }
+        if (total_size != size_ || (blocks_.empty() && !bytes_.empty())) {
+            throw invalid_argument("Corrupted posting list block");
+        }
+    }
+
+private:
+    struct Block {
+        int first_ordinal;
+        int last_ordinal;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    vector<Block> blocks_;
+    vector<uint8_t> bytes_;
+    size_t size_ = 0;
+
+    void WriteVarint(uint32_t value) {
+        while (value >= 0x80) {
+            bytes_.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        bytes_.push_back(static_cast<uint8_t>(value));
+    }
+
+    //для непроверенных данных: не выходит за end и не принимает значения длиннее 32 бит
+    static uint32_t ReadVarint(const uint8_t*& data, const uint8_t* end) {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 32; shift += 7) {
+            if (data == end) {
+                break;
+            }
+            const uint8_t byte = *data++;
+            if (shift == 28 && byte > 0x0F) {
+                break;
+            }
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+        throw invalid_argument("Corrupted posting list block");
+    }
+
+    static uint32_t ReadVarint(const uint8_t*& data) {
+        uint32_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            const uint8_t byte = *data++;
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+    }
 };
 
 class SearchServer {
 public:
+    //map{слово,TF} документа из GetWordFrequencies. Узлы прямого индекса выделяются из пула индекса, поэтому
+    //это pmr::map, а не map<string_view, double>, как было раньше. Код, который называл старый тип явно,
+    //должен перейти на SearchServer::WordFrequencies или const auto&: по интерфейсу поиска и обхода типы совпадают
+    using WordFrequencies = pmr::map<string_view, double>;
+
     template<typename Container>
     explicit SearchServer(const Container& words) {
         for (const auto& word : words) {
-            for (auto c : word) {
-                if (c >= FIRST_SPECIAL_SYMBOL && c <= LAST_SPECIAL_SYMBOL) {
-                    throw invalid_argument("Invalid char in stop-words collection");
+            if (HasSpecialSymbol(word)) {
+                throw invalid_argument("Invalid char in stop-words collection");
+            }
+            stop_words_.insert(word);
+        }
+    }
+
+    //без стоп-слов, их можно задать позже через SetStopWords
+    SearchServer() = default;
+
+    explicit SearchServer(const string& s) {
+        SetStopWords(s);
+    }
+
+    explicit SearchServer(string_view s) {
+        SetStopWords(s);
+    }
+
+    //прямой индекс ссылается на слова внутри words_to_docs_with_freq, поэтому копирование запрещено,
+    //а перемещение безопасно: узлы map при перемещении остаются на месте
+    SearchServer(const SearchServer&) = delete;
+    SearchServer& operator=(const SearchServer&) = delete;
+    SearchServer(SearchServer&&) = default;
+    SearchServer& operator=(SearchServer&&) = default;
+
+    void SetStopWords(string_view text) {
+        for (const string_view word : SplitIntoWords(text)) {
+            stop_words_.emplace(word);
+        }
+    }
+
+    void AddDocument(int document_id, string_view document, DocumentStatus status, vector<int> rating) {
+        array<byte, SCRATCH_BUFFER_SIZE> scratch_buffer;
+        pmr::monotonic_buffer_resource scratch(scratch_buffer.data(), scratch_buffer.size());
+        const auto words_freq = SplitIntoWordsNoStop(document, &scratch); // map{word,TF}
+        BuildForwardIndexIfNeeded();
+
+
+        if (document_id < 0) {
+            throw invalid_argument("Try to add document with negative id");
+        }
+        if (id_to_ordinal_.count(document_id)) {
+            throw invalid_argument("Try to add document with existing id");
+        }
+        //документ получает следующий по порядку внутренний номер, метаданные лежат в векторах по этому номеру
+        const int ordinal = static_cast<int>(ordinal_to_id_.size());
+        id_to_ordinal_[document_id] = ordinal;
+        ordinal_to_id_.push_back(document_id);
+        ratings_.push_back(ComputeAverageRating(rating));
+        statuses_.push_back(status);
+        word_counts_.push_back(0);
+        auto& document_word_freqs = index_->ordinal_to_word_freqs.emplace_back();
+        document_ids_.push_back(document_id);
+
+        //реализация SplitIntoWordsNoStop изменена, возвращает map{слово,количество повторов слова в документе},
+        //поэтому для расчета суммарного количества слов используется accumulate
+        int total_words = accumulate(words_freq.value().begin(), words_freq.value().end(), 0, [](int sum, const pair<string_view, int>& next) {
+            return sum + next.second;
+            });
+        word_counts_.back() = total_words;
+
+        for (const auto& word : words_freq.value()) {
+            const auto word_it = FindOrInsertWord(word.first);
+            const double tf = word.second * 1.0 / total_words;
+            //номера растут, поэтому posting list остается отсортированным при добавлении в конец
+            if (postings_compressed_) {
+                word_it->second.compressed.PushBack(ordinal, word.second);
+            }
+            else {
+                word_it->second.postings.push_back({ ordinal, tf });
+            }
+            word_it->second.max_tf = max(word_it->second.max_tf, tf);
+            //string_view в прямом индексе указывает на ключ words_to_docs_with_freq, слова не дублируются
+            document_word_freqs[word_it->first] = tf;
+        }
+
+        ++document_count_;
+        ++index_generation_;
+    }
+
+    void AddDocuments(const vector<RawDocument>& documents) {
+        for (const RawDocument& document : documents) {
+            AddDocument(document.id, document.text, document.status, document.ratings);
+        }
+    }
+
+    //пакетное построение: документы делятся на непрерывные куски, по каждому куску отдельно строится частичный индекс
+    //(разбор на слова и подсчет повторов), затем частичные индексы сливаются в общий в порядке кусков.
+    //Результат и исключения те же, что у последовательных AddDocument: документы до первого ошибочного добавляются,
+    //затем выбрасывается его исключение
+    template <typename ExecutionPolicy>
+    void AddDocuments(const ExecutionPolicy& policy, const vector<RawDocument>& documents) {
+        static_assert(is_execution_policy_v<ExecutionPolicy>);
+        if (documents.empty()) {
+            return;
+        }
+        BuildForwardIndexIfNeeded();
+
+        const size_t chunk_count = min(documents.size(), static_cast<size_t>(max(1u, thread::hardware_concurrency()) * 4));
+        const size_t chunk_size = (documents.size() + chunk_count - 1) / chunk_count;
+        vector<PartialIndex> partial_indexes(chunk_count);
+        for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+            partial_indexes[chunk].begin = min(chunk * chunk_size, documents.size());
+            partial_indexes[chunk].end = min(partial_indexes[chunk].begin + chunk_size, documents.size());
+        }
+        for_each(policy, partial_indexes.begin(), partial_indexes.end(), [this, &documents](PartialIndex& partial_index) {
+            BuildPartialIndex(documents, partial_index);
+            });
+
+        //проверка id последовательно, в том же порядке, что у AddDocument: сначала ошибка разбора, затем id
+        size_t valid_count = documents.size();
+        exception_ptr error;
+        set<int> batch_ids;
+        for (const PartialIndex& partial_index : partial_indexes) {
+            for (size_t i = partial_index.begin; i < partial_index.end && !error; ++i) {
+                if (i == partial_index.error_index) {
+                    error = partial_index.error;
+                }
+                else if (documents[i].id < 0) {
+                    error = make_exception_ptr(invalid_argument("Try to add document with negative id"));
+                }
+                else if (id_to_ordinal_.count(documents[i].id) || !batch_ids.insert(documents[i].id).second) {
+                    error = make_exception_ptr(invalid_argument("Try to add document with existing id"));
+                }
+                if (error) {
+                    valid_count = i;
+                }
+            }
+        }
+
+        //слияние: номера документов идут подряд по кускам, поэтому posting list остаются отсортированными
+        const int first_ordinal = static_cast<int>(ordinal_to_id_.size());
+        for (size_t i = 0; i < valid_count; ++i) {
+            const RawDocument& document = documents[i];
+            id_to_ordinal_[document.id] = first_ordinal + static_cast<int>(i);
+            ordinal_to_id_.push_back(document.id);
+            ratings_.push_back(ComputeAverageRating(document.ratings));
+            statuses_.push_back(document.status);
+            document_ids_.push_back(document.id);
+        }
+        word_counts_.resize(ordinal_to_id_.size());
+        index_->ordinal_to_word_freqs.resize(ordinal_to_id_.size());
+        for (PartialIndex& partial_index : partial_indexes) {
+            const size_t end = min(partial_index.end, valid_count);
+            for (size_t i = partial_index.begin; i < end; ++i) {
+                word_counts_[first_ordinal + i] = partial_index.word_counts[i - partial_index.begin];
+            }
+            partial_index.dictionary_words.reserve(partial_index.words.size());
+            for (const auto& [word, word_postings] : partial_index.words) {
+                auto word_it = index_->words_to_docs_with_freq.end();
+                for (const auto& [i, count] : word_postings) {
+                    if (i >= end) {
+                        break;
+                    }
+                    if (word_it == index_->words_to_docs_with_freq.end()) {
+                        word_it = FindOrInsertWord(word);
+                    }
+                    const int ordinal = first_ordinal + static_cast<int>(i);
+                    const double tf = count * 1.0 / word_counts_[ordinal];
+                    if (postings_compressed_) {
+                        word_it->second.compressed.PushBack(ordinal, count);
+                    }
+                    else {
+                        word_it->second.postings.push_back({ ordinal, tf });
+                    }
+                    word_it->second.max_tf = max(word_it->second.max_tf, tf);
+                }
+                partial_index.dictionary_words.push_back(word_it == index_->words_to_docs_with_freq.end() ? string_view() : word_it->first);
+            }
+        }
+
+        //прямой индекс заполняется параллельно: у каждого куска свои документы
+        for_each(policy, partial_indexes.begin(), partial_indexes.end(), [this, first_ordinal, valid_count](const PartialIndex& partial_index) {
+            auto dictionary_word = partial_index.dictionary_words.begin();
+            for (const auto& [_, word_postings] : partial_index.words) {
+                const string_view word = *dictionary_word++;
+                for (const auto& [i, count] : word_postings) {
+                    if (i >= valid_count) {
+                        break;
+                    }
+                    const int ordinal = first_ordinal + static_cast<int>(i);
+                    auto& word_freqs = index_->ordinal_to_word_freqs[ordinal];
+                    word_freqs.emplace_hint(word_freqs.end(), word, count * 1.0 / word_counts_[ordinal]);
+                }
+            }
+            });
+
+        document_count_ += static_cast<int>(valid_count);
+        if (valid_count > 0) {
+            ++index_generation_;
+        }
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+
+    void RemoveDocument(int document_id) {
+        RemoveDocument(execution::seq, document_id);
+    }
+
+    template <typename ExecutionPolicy>
+    void RemoveDocument(const ExecutionPolicy& policy, int document_id) {
+        RemoveDocuments(policy, { document_id });
+    }
+
+    //несуществующие id пропускаются. Затрагиваются только posting list слов удаляемых документов,
+    //каждый из них чистится за один проход, с execution::par - параллельно по словам
+    template <typename ExecutionPolicy>
+    void RemoveDocuments(const ExecutionPolicy& policy, vector<int> document_ids) {
+        static_assert(is_execution_policy_v<ExecutionPolicy>);
+        sort(document_ids.begin(), document_ids.end());
+        document_ids.erase(unique(document_ids.begin(), document_ids.end()), document_ids.end());
+        document_ids.erase(remove_if(document_ids.begin(), document_ids.end(), [this](int document_id) {
+            return id_to_ordinal_.count(document_id) == 0;
+            }), document_ids.end());
+        if (document_ids.empty()) {
+            return;
+        }
+        BuildForwardIndexIfNeeded();
+
+        //номер удаленного документа остается пустым: id -1, пустой прямой индекс
+        vector<int> ordinals;
+        for (const int document_id : document_ids) {
+            const int ordinal = id_to_ordinal_.at(document_id);
+            ordinals.push_back(ordinal);
+            ordinal_to_id_[ordinal] = REMOVED_DOCUMENT_ID;
+            id_to_ordinal_.erase(document_id);
+        }
+
+        vector<WordIterator> affected_words;
+        for (const int ordinal : ordinals) {
+            for (const auto& [word, _] : index_->ordinal_to_word_freqs[ordinal]) {
+                affected_words.push_back(index_->words_to_docs_with_freq.find(word));
+            }
+        }
+        const auto by_address = [](WordIterator lhs, WordIterator rhs) {
+            return &*lhs < &*rhs;
+        };
+        sort(affected_words.begin(), affected_words.end(), by_address);
+        affected_words.erase(unique(affected_words.begin(), affected_words.end()), affected_words.end());
+
+        for_each(policy, affected_words.begin(), affected_words.end(), [this](WordIterator word_it) {
+            const auto is_removed = [this](int ordinal) {
+                return ordinal_to_id_[ordinal] == REMOVED_DOCUMENT_ID;
+            };
+            auto& posting_list = word_it->second;
+            if (postings_compressed_) {
+                posting_list.compressed.RemoveIf(is_removed);
+            }
+            else {
+                auto& postings = posting_list.postings;
+                postings.erase(remove_if(postings.begin(), postings.end(), [&is_removed](const Posting& posting) {
+                    return is_removed(posting.ordinal);
+                    }), postings.end());
+            }
+            //удаленный документ мог давать наибольший TF
+            posting_list.max_tf = 0;
+            ForEachPosting(posting_list, [&posting_list](int, double tf) {
+                posting_list.max_tf = max(posting_list.max_tf, tf);
+                });
+            });
+
+        //слова, которые встречались только в удаленных документах, убираются из словаря.
+        //После этого string_view удаляемых документов на эти слова больше не используются
+        for (const auto word_it : affected_words) {
+            if (GetPostingCount(word_it->second) == 0) {
+                index_->words_to_docs_with_freq.erase(word_it);
+            }
+        }
+
+        for (const int ordinal : ordinals) {
+            index_->ordinal_to_word_freqs[ordinal].clear();
+        }
+        //список id в порядке добавления пересобирается из ordinal_to_id_ при первом обращении, а не здесь
+        document_ids_pending_ = true;
+        document_ids_once_ = make_unique<once_flag>();
+        document_count_ -= static_cast<int>(document_ids.size());
+        ++index_generation_;
+
+        //пустых номеров стало больше, чем документов: номера перенумеровываются подряд
+        if (ordinal_to_id_.size() > 2 * static_cast<size_t>(document_count_)) {
+            CompactOrdinals(policy);
+        }
+    }
+
+    //top_k - сколько лучших документов вернуть, по умолчанию MAX_RESULT_DOCUMENT_COUNT
+    template <typename Filter>
+    vector<Document> FindTopDocuments(string_view raw_query, Filter conditions, size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const {
+        return FindTopDocuments(execution::seq, raw_query, conditions, top_k);
+    }
+
+    template <typename ExecutionPolicy, typename Filter>
+    vector<Document> FindTopDocuments(const ExecutionPolicy& policy, string_view raw_query, Filter conditions,
+                                      size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const {
+        static_assert(is_execution_policy_v<ExecutionPolicy>);
+        array<byte, SCRATCH_BUFFER_SIZE> scratch_buffer;
+        pmr::monotonic_buffer_resource scratch(scratch_buffer.data(), scratch_buffer.size());
+        const auto query_words = ParseQuery(raw_query, &scratch);
+
+        //с обязательными словами документы находятся пересечением posting list, а не обходом всех плюс-слов
+        if (!query_words.required.empty()) {
+            return FindRequiredDocuments(query_words, conditions, top_k);
+        }
+        //результат уже отобран и отсортирован в FindAllDocuments
+        return FindAllDocuments(policy, query_words, conditions, top_k);
+    }
+    //status template specification
+
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus needed_status = DocumentStatus::ACTUAL,
+                                      size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const {
+        return FindTopDocuments(raw_query, [needed_status](int document_id, DocumentStatus status, int rating) {
+            return status == needed_status;
+            }, top_k);
+    }
+
+    template <typename ExecutionPolicy>
+    vector<Document> FindTopDocuments(const ExecutionPolicy& policy, string_view raw_query, DocumentStatus needed_status = DocumentStatus::ACTUAL,
+                                      size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const {
+        return FindTopDocuments(policy, raw_query, [needed_status](int document_id, DocumentStatus status, int rating) {
+            return status == needed_status;
+            }, top_k);
+    }
+
+    int GetDocumentCount() const {
+        return document_count_;
+    }
+
+    //меняется при каждом добавлении или удалении документов. Результат, посчитанный при другом поколении, устарел
+    uint64_t GetGeneration() const {
+        return index_generation_;
+    }
+
+#ifdef SEARCH_SERVER_PROFILE
+    //гистограммы времени этапов поиска, есть только при компиляции с -DSEARCH_SERVER_PROFILE
+    const QueryProfile& GetQueryProfile() const {
+        return *query_profile_;
+    }
+
+    void ResetQueryProfile() {
+        query_profile_->Reset();
+    }
+#endif
+
+    //нормализованный запрос: плюс-слова, затем минус-слова с '-', без стоп-слов, по возрастанию и без повторов.
+    //Запросы, отличающиеся только порядком, повтором слов или стоп-словами, получают одну строку
+    string NormalizeQuery(string_view raw_query) const {
+        array<byte, SCRATCH_BUFFER_SIZE> scratch_buffer;
+        pmr::monotonic_buffer_resource scratch(scratch_buffer.data(), scratch_buffer.size());
+        const auto query_words = ParseQuery(raw_query, &scratch);
+        string result;
+        for (const string_view word : query_words.plus) {
+            result += word;
+            result += ' ';
+        }
+        for (const string_view word : query_words.minus) {
+            result += '-';
+            result += word;
+            result += ' ';
+        }
+        for (const string_view word : query_words.required) {
+            result += '+';
+            result += word;
+            result += ' ';
+        }
+        return result;
+    }
+
+    //string_view результата указывают на слова индекса и действительны, пока слово есть в индексе
+    tuple<vector<string_view>, DocumentStatus> MatchDocument(string_view raw_query, int document_id) const {
+        return MatchDocument(execution::seq, raw_query, document_id);
+    }
+
+    template <typename ExecutionPolicy>
+    tuple<vector<string_view>, DocumentStatus> MatchDocument(const ExecutionPolicy& policy, string_view raw_query, int document_id) const {
+        static_assert(is_execution_policy_v<ExecutionPolicy>);
+        array<byte, SCRATCH_BUFFER_SIZE> scratch_buffer;
+        pmr::monotonic_buffer_resource scratch(scratch_buffer.data(), scratch_buffer.size());
+        const auto query_words = ParseQuery(raw_query, &scratch);
+        //слова ищутся в прямом индексе документа, а не во всем словаре
+        const int ordinal = id_to_ordinal_.at(document_id);
+        BuildForwardIndexIfNeeded();
+        const auto& word_freqs = index_->ordinal_to_word_freqs[ordinal];
+        const DocumentStatus status = statuses_[ordinal];
+
+        //любое минус-слово или отсутствие обязательного слова обнуляет результат, поэтому они проверяются первыми
+        const auto has_word = [&word_freqs](string_view word) {
+            return word_freqs.count(word) > 0;
+        };
+        if (any_of(policy, query_words.minus.begin(), query_words.minus.end(), has_word)
+            || !all_of(policy, query_words.required.begin(), query_words.required.end(), has_word)) {
+            return { vector<string_view>(), status };
+        }
+
+        //плюс-слова запроса уже отсортированы, поэтому результат сортировать не нужно
+        vector<string_view> matched_words(query_words.plus.size());
+        transform(policy, query_words.plus.begin(), query_words.plus.end(), matched_words.begin(), [&word_freqs](string_view word) {
+            const auto it = word_freqs.find(word);
+            return it == word_freqs.end() ? string_view() : it->first;
+            });
+        matched_words.erase(remove(matched_words.begin(), matched_words.end(), string_view()), matched_words.end());
+
+        if (matched_words.size() > MAX_RESULT_DOCUMENT_COUNT) {
+            matched_words.resize(MAX_RESULT_DOCUMENT_COUNT);
+        }
+
+        return { matched_words, status };
+    }
+
+    //переводит все posting list в сжатый вид (CompressedPostingList), занимающий в разы меньше памяти.
+    //Поиск, добавление и удаление документов продолжают работать, TF восстанавливается точно
+    void CompressPostings() {
+        if (postings_compressed_) {
+            return;
+        }
+        for (auto& [word, posting_list] : index_->words_to_docs_with_freq) {
+            posting_list.compressed = CompressPostingList(posting_list.postings);
+            posting_list.postings.clear();
+            posting_list.postings.shrink_to_fit();
+        }
+        postings_compressed_ = true;
+    }
+
+    bool IsPostingsCompressed() const {
+        return postings_compressed_;
+    }
+
+    //снимок индекса: стоп-слова, метаданные документов и posting list (в сжатом виде) в версионированном
+    //бинарном файле. Прямой индекс не сохраняется, он восстанавливается из posting list после загрузки
+    void SaveIndex(const string& path) const {
+        ofstream out(path, ios::binary);
+        if (!out) {
+            throw runtime_error("Can't create file " + path);
+        }
+        BinaryWriter writer(out);
+        out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        writer.Write(SNAPSHOT_VERSION);
+        writer.Write(static_cast<uint8_t>(postings_compressed_));
+
+        writer.Write(static_cast<uint64_t>(stop_words_.size()));
+        for (const string& word : stop_words_) {
+            writer.WriteString(word);
+        }
+
+        writer.WriteVector(ordinal_to_id_);
+        writer.WriteVector(ratings_);
+        writer.WriteVector(statuses_);
+        writer.WriteVector(word_counts_);
+        BuildDocumentIdsIfNeeded();
+        writer.WriteVector(document_ids_);
+        writer.Write(static_cast<int32_t>(document_count_));
+
+        writer.Write(static_cast<uint64_t>(index_->words_to_docs_with_freq.size()));
+        for (const auto& [word, posting_list] : index_->words_to_docs_with_freq) {
+            writer.WriteString(word);
+            if (postings_compressed_) {
+                posting_list.compressed.Save(writer);
+            }
+            else {
+                CompressPostingList(posting_list.postings).Save(writer);
+            }
+        }
+
+        if (!out) {
+            throw runtime_error("Can't write file " + path);
+        }
+    }
+
+    //файл отображается в память и разбирается без токенизации документов. Прямой индекс (MatchDocument,
+    //GetWordFrequencies, удаление) строится при первом обращении к нему, FindTopDocuments его не ждет
+    static SearchServer LoadIndex(const string& path) {
+        const MappedFile file(path);
+        BinaryReader reader(file.data(), file.data() + file.size());
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        for (char& c : magic) {
+            c = reader.Read<char>();
+        }
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || reader.Read<uint32_t>() != SNAPSHOT_VERSION) {
+            throw invalid_argument("Unsupported index snapshot " + path);
+        }
+
+        SearchServer server(""sv);
+        server.postings_compressed_ = reader.Read<uint8_t>() != 0;
+
+        for (uint64_t i = reader.Read<uint64_t>(); i > 0; --i) {
+            server.stop_words_.emplace(reader.ReadString());
+        }
+
+        reader.ReadVector(server.ordinal_to_id_);
+        reader.ReadVector(server.ratings_);
+        reader.ReadVector(server.statuses_);
+        reader.ReadVector(server.word_counts_);
+        reader.ReadVector(server.document_ids_);
+        server.document_count_ = reader.Read<int32_t>();
+
+        const size_t ordinal_count = server.ordinal_to_id_.size();
+        if (server.ratings_.size() != ordinal_count || server.statuses_.size() != ordinal_count
+            || server.word_counts_.size() != ordinal_count) {
+            throw invalid_argument("Corrupted index snapshot " + path);
+        }
+        for (size_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+            if (server.ordinal_to_id_[ordinal] != REMOVED_DOCUMENT_ID
+                && !server.id_to_ordinal_.emplace(server.ordinal_to_id_[ordinal], static_cast<int>(ordinal)).second) {
+                throw invalid_argument("Corrupted index snapshot " + path);
+            }
+        }
+        if (server.id_to_ordinal_.size() != static_cast<size_t>(server.document_count_)) {
+            throw invalid_argument("Corrupted index snapshot " + path);
+        }
+        //document_ids_ - те же живые id в порядке номеров, statuses_ - только значения DocumentStatus
+        if (server.document_ids_.size() != server.id_to_ordinal_.size()) {
+            throw invalid_argument("Corrupted index snapshot " + path);
+        }
+        auto document_id_it = server.document_ids_.begin();
+        for (size_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+            if (server.ordinal_to_id_[ordinal] != REMOVED_DOCUMENT_ID && server.ordinal_to_id_[ordinal] != *document_id_it++) {
+                throw invalid_argument("Corrupted index snapshot " + path);
+            }
+            const int status = static_cast<int>(server.statuses_[ordinal]);
+            if (status < static_cast<int>(DocumentStatus::ACTUAL) || status > static_cast<int>(DocumentStatus::REMOVED)) {
+                throw invalid_argument("Corrupted index snapshot " + path);
+            }
+        }
+        server.index_->ordinal_to_word_freqs.resize(ordinal_count);
+        server.forward_index_pending_ = true;
+
+        for (uint64_t i = reader.Read<uint64_t>(); i > 0; --i) {
+            const string_view word = reader.ReadString();
+            if (server.index_->words_to_docs_with_freq.count(word)) {
+                throw invalid_argument("Corrupted index snapshot " + path);
+            }
+            auto& posting_list = server.FindOrInsertWord(word)->second;
+            posting_list.compressed.Load(reader);
+            if (posting_list.compressed.size() == 0) {
+                throw invalid_argument("Corrupted index snapshot " + path);
+            }
+            //порядок номеров и границы блоков проверил Load, здесь - что номер принадлежит живому документу
+            //и TF в (0, 1]: при нулевом числе слов документа TF был бы бесконечным
+            posting_list.compressed.ForEach([&](int ordinal, int count) {
+                if (static_cast<size_t>(ordinal) >= ordinal_count || server.ordinal_to_id_[ordinal] == REMOVED_DOCUMENT_ID
+                    || count <= 0 || count > server.word_counts_[ordinal]) {
+                    throw invalid_argument("Corrupted index snapshot " + path);
+                }
+                const double tf = count * 1.0 / server.word_counts_[ordinal];
+                if (!server.postings_compressed_) {
+                    posting_list.postings.push_back({ ordinal, tf });
+                }
+                posting_list.max_tf = max(posting_list.max_tf, tf);
+                });
+            if (!server.postings_compressed_) {
+                posting_list.compressed = CompressedPostingList();
+            }
+        }
+
+        return server;
+    }
+
+    //байт, занятых posting list (без словаря и метаданных документов)
+    size_t GetPostingsMemoryUsage() const {
+        size_t result = 0;
+        for (const auto& [word, posting_list] : index_->words_to_docs_with_freq) {
+            result += posting_list.postings.capacity() * sizeof(Posting) + posting_list.compressed.MemoryUsage();
+        }
+        return result;
+    }
+
+    //map{слово,TF} документа, для несуществующего id - пустой map
+    const WordFrequencies& GetWordFrequencies(int document_id) const {
+        static const WordFrequencies empty_word_freqs;
+        const auto it = id_to_ordinal_.find(document_id);
+        if (it == id_to_ordinal_.end()) {
+            return empty_word_freqs;
+        }
+        BuildForwardIndexIfNeeded();
+        return index_->ordinal_to_word_freqs[it->second];
+    }
+
+    //id документов в порядке добавления
+    vector<int>::const_iterator begin() const {
+        BuildDocumentIdsIfNeeded();
+        return document_ids_.begin();
+    }
+
+    vector<int>::const_iterator end() const {
+        BuildDocumentIdsIfNeeded();
+        return document_ids_.end();
+    }
+
+    int GetDocumentId(int index)const {
+        BuildDocumentIdsIfNeeded();
+        if (index < 0 || index >= static_cast<int>(document_ids_.size())) {
+            throw out_of_range("Invalid index");
+        }
+        return document_ids_.at(index);
+    }
+
+private:
+
+    static constexpr int REMOVED_DOCUMENT_ID = -1;
+
+    struct Posting {
+        int ordinal = 0;
+        double tf = 0;
+    };
+
+    //заполнен postings или compressed, в зависимости от postings_compressed_
+    struct PostingList {
+        vector<Posting> postings;
+        CompressedPostingList compressed;
+        //IDF слова, посчитанный при index_generation_ == idf_generation. Пересчитывается лениво при
+        //первом запросе после изменения индекса; atomic, т.к. запросы могут идти из нескольких потоков
+        mutable atomic<uint64_t> idf_generation{ 0 };
+        mutable atomic<double> idf{ 0 };
+        //наибольший TF в списке: max_tf * IDF - верхняя граница вклада слова в релевантность любого документа
+        double max_tf = 0;
+    };
+
+    //узлы словаря, строки-ключи и прямой индекс выделяются из пула, а не по одному из общей кучи.
+    //Пул лежит в одном объекте с контейнерами, которые из него выделяют, и при перемещении SearchServer
+    //переезжает вместе с ними через unique_ptr. synchronized - AddDocuments(par) заполняет прямой индекс из нескольких потоков
+    struct IndexStorage {
+        pmr::synchronized_pool_resource pool;
+
+        //map{слово,vector{номер документа,TF}}, vector отсортирован по номеру и лежит в памяти непрерывно
+        //less<> позволяет искать по string_view без создания string
+        pmr::map<pmr::string, PostingList, less<>> words_to_docs_with_freq{ &pool };
+
+        //прямой индекс vector{номер,map{слово,TF}}, после LoadIndex строится лениво из const методов
+        pmr::vector<WordFrequencies> ordinal_to_word_freqs{ &pool };
+    };
+
+    unique_ptr<IndexStorage> index_ = make_unique<IndexStorage>();
+
+    using WordIterator = decltype(IndexStorage::words_to_docs_with_freq)::iterator;
+
+    set<string, less<>> stop_words_;
+
+    //внешний id -> внутренний номер документа (ordinal), номера идут подряд с 0 в порядке добавления
+    map<int, int> id_to_ordinal_;
+
+    //метаданные документов, индекс в векторах - номер документа
+    vector<int> ordinal_to_id_;
+
+    vector<int> ratings_;
+
+    vector<DocumentStatus> statuses_;
+
+    //количество слов документа без стоп-слов, нужно для восстановления TF из сжатых posting list
+    vector<int> word_counts_;
+
+    bool postings_compressed_ = false;
+
+    mutable bool forward_index_pending_ = false;
+
+    //unique_ptr, т.к. once_flag нельзя перемещать
+    mutable unique_ptr<once_flag> forward_index_once_ = make_unique<once_flag>();
+
+    //id живых документов в порядке добавления. Порядок тот же, что у номеров, поэтому после удаления
+    //список собирается из ordinal_to_id_ без пустых номеров, один раз на серию удалений
+    mutable vector<int> document_ids_;
+    mutable bool document_ids_pending_ = false;
+    mutable unique_ptr<once_flag> document_ids_once_ = make_unique<once_flag>();
+
+    int document_count_ = 0;
+
+#ifdef SEARCH_SERVER_PROFILE
+    //unique_ptr - счетчики атомарные и не перемещаются, а SearchServer перемещать можно.
+    //Без SEARCH_SERVER_PROFILE поля нет, и сервер не тратит на замеры ни памяти, ни времени
+    unique_ptr<QueryProfile> query_profile_ = make_unique<QueryProfile>();
+#endif
+
+    //меняется при каждом добавлении/удалении документа, сбрасывает кэш IDF
+    uint64_t index_generation_ = 1;
+
+    double CalculateIDF(const PostingList& posting_list) const {
+        if (posting_list.idf_generation.load(memory_order_acquire) == index_generation_) {
+            return posting_list.idf.load(memory_order_relaxed);
+        }
+        const double idf = log(document_count_ * 1.0 / GetPostingCount(posting_list));
+        posting_list.idf.store(idf, memory_order_relaxed);
+        posting_list.idf_generation.store(index_generation_, memory_order_release);
+        return idf;
+    }
+
+    //частичный индекс куска документов [begin, end) для AddDocuments(policy, ...).
+    //words - map{слово,vector{номер документа в пакете,количество повторов}}, слова ссылаются на текст документов
+    struct PartialIndex {
+        size_t begin = 0;
+        size_t end = 0;
+        map<string_view, vector<pair<size_t, int>>> words;
+        vector<int> word_counts;
+        //ключи общего словаря в порядке words, на них ссылается прямой индекс
+        vector<string_view> dictionary_words;
+        //первый документ куска, который не удалось разобрать
+        size_t error_index = numeric_limits<size_t>::max();
+        exception_ptr error;
+    };
+
+    void BuildPartialIndex(const vector<RawDocument>& documents, PartialIndex& partial_index) const {
+        array<byte, SCRATCH_BUFFER_SIZE> scratch_buffer;
+        pmr::monotonic_buffer_resource scratch(scratch_buffer.data(), scratch_buffer.size());
+        for (size_t i = partial_index.begin; i < partial_index.end; ++i) {
+            int total_words = 0;
+            //временная память разбора предыдущего документа больше не нужна
+            scratch.release();
+            try {
+                const auto words_freq = SplitIntoWordsNoStop(documents[i].text, &scratch);
+                for (const auto& [word, count] : words_freq.value()) {
+                    partial_index.words[word].push_back({ i, count });
+                    total_words += count;
+                }
+            }
+            catch (...) {
+                partial_index.error_index = i;
+                partial_index.error = current_exception();
+                return;
+            }
+            partial_index.word_counts.push_back(total_words);
+        }
+    }
+
+    //строка-ключ создается сразу в пуле индекса, без промежуточной string
+    WordIterator FindOrInsertWord(string_view word) {
+        const auto word_it = index_->words_to_docs_with_freq.find(word);
+        if (word_it != index_->words_to_docs_with_freq.end()) {
+            return word_it;
+        }
+        return index_->words_to_docs_with_freq.emplace(piecewise_construct, forward_as_tuple(word), tuple<>()).first;
+    }
+
+    //плотные массивы по номерам документов для FindAllDocuments(seq). Не выделяются заново на каждый запрос:
+    //живут в потоке и обнуляются по ходу отбора, поэтому между запросами в них всегда нули.
+    //touched - номера, которым запрос добавил релевантность, в порядке первого касания; длина списка возвращается
+    //из ScoreDocuments. Номер пишется в touched[touched_count] на каждой позиции posting list, а счетчик растет
+    //только при первом касании, поэтому запись идет без ветвлений. Когда тронуты все номера, следующая запись
+    //уходит в лишнюю последнюю ячейку, поэтому touched на одну ячейку длиннее остальных массивов
+    struct DenseScratch {
+        vector<double> relevance;
+        vector<char> matched;
+        vector<int> touched;
+    };
+
+    static DenseScratch& GetDenseScratch(size_t size) {
+        thread_local DenseScratch scratch;
+        if (scratch.relevance.size() < size) {
+            scratch.relevance.resize(size);
+            scratch.matched.resize(size);
+            scratch.touched.resize(size + 1);
+        }
+        return scratch;
+    }
+
+    //номера удаленных документов не переиспользуются, поэтому время от времени живые документы перенумеровываются
+    //подряд с сохранением порядка: posting list остаются отсортированными, метаданные и плотные массивы запросов
+    //перестают расти от добавлений и удалений. Прямой индекс к этому моменту уже построен в RemoveDocuments
+    template <typename ExecutionPolicy>
+    void CompactOrdinals(const ExecutionPolicy& policy) {
+        vector<int> new_ordinals(ordinal_to_id_.size(), REMOVED_DOCUMENT_ID);
+        int live_count = 0;
+        for (size_t ordinal = 0; ordinal < ordinal_to_id_.size(); ++ordinal) {
+            if (ordinal_to_id_[ordinal] == REMOVED_DOCUMENT_ID) {
+                continue;
+            }
+            const int new_ordinal = live_count++;
+            new_ordinals[ordinal] = new_ordinal;
+            ordinal_to_id_[new_ordinal] = ordinal_to_id_[ordinal];
+            ratings_[new_ordinal] = ratings_[ordinal];
+            statuses_[new_ordinal] = statuses_[ordinal];
+            word_counts_[new_ordinal] = word_counts_[ordinal];
+            //map из того же пула перемещается без копирования узлов
+            index_->ordinal_to_word_freqs[new_ordinal] = move(index_->ordinal_to_word_freqs[ordinal]);
+        }
+        ordinal_to_id_.resize(live_count);
+        ratings_.resize(live_count);
+        statuses_.resize(live_count);
+        word_counts_.resize(live_count);
+        index_->ordinal_to_word_freqs.resize(live_count);
+        for (auto& [document_id, ordinal] : id_to_ordinal_) {
+            ordinal = new_ordinals[ordinal];
+        }
+
+        for_each(policy, index_->words_to_docs_with_freq.begin(), index_->words_to_docs_with_freq.end(),
+                 [this, &new_ordinals](auto& word_and_postings) {
+            auto& posting_list = word_and_postings.second;
+            if (postings_compressed_) {
+                CompressedPostingList renumbered;
+                posting_list.compressed.ForEach([&renumbered, &new_ordinals](int ordinal, int count) {
+                    renumbered.PushBack(new_ordinals[ordinal], count);
+                    });
+                renumbered.ShrinkToFit();
+                posting_list.compressed = move(renumbered);
+            }
+            else {
+                for (auto& posting : posting_list.postings) {
+                    posting.ordinal = new_ordinals[posting.ordinal];
+                }
+            }
+            });
+    }
+
+    //потокобезопасно: параллельные MatchDocument дождутся одного построения
+    void BuildForwardIndexIfNeeded() const {
+        call_once(*forward_index_once_, [this] {
+            if (!forward_index_pending_) {
+                return;
+            }
+            for (const auto& [word, posting_list] : index_->words_to_docs_with_freq) {
+                //слова идут по возрастанию, поэтому вставка в конец map каждого документа
+                ForEachPosting(posting_list, [this, &word = word](int ordinal, double tf) {
+                    auto& word_freqs = index_->ordinal_to_word_freqs[ordinal];
+                    word_freqs.emplace_hint(word_freqs.end(), word, tf);
+                    });
+            }
+            forward_index_pending_ = false;
+            });
+    }
+
+    void BuildDocumentIdsIfNeeded() const {
+        call_once(*document_ids_once_, [this] {
+            if (!document_ids_pending_) {
+                return;
+            }
+            document_ids_.clear();
+            for (const int document_id : ordinal_to_id_) {
+                if (document_id != REMOVED_DOCUMENT_ID) {
+                    document_ids_.push_back(document_id);
+                }
+            }
+            document_ids_pending_ = false;
+            });
+    }
+
+    CompressedPostingList CompressPostingList(const vector<Posting>& postings) const {
+        CompressedPostingList result;
+        for (const auto& [ordinal, tf] : postings) {
+            result.PushBack(ordinal, static_cast<int>(llround(tf * word_counts_[ordinal])));
+        }
+        result.ShrinkToFit();
+        return result;
+    }
+
+    size_t GetPostingCount(const PostingList& posting_list) const {
+        return postings_compressed_ ? posting_list.compressed.size() : posting_list.postings.size();
+    }
+
+    //func(номер документа, TF) для каждой записи posting list в порядке номеров
+    template <typename Func>
+    void ForEachPosting(const PostingList& posting_list, Func func) const {
+        if (!postings_compressed_) {
+            for (const auto& [ordinal, tf] : posting_list.postings) {
+                func(ordinal, tf);
+            }
+            return;
+        }
+        posting_list.compressed.ForEach([this, &func](int ordinal, int count) {
+            func(ordinal, count * 1.0 / word_counts_[ordinal]);
+            });
+    }
+
+    //то же только для записей с номерами из [first, last)
+    template <typename Func>
+    void ForEachPostingInRange(const PostingList& posting_list, int first, int last, Func func) const {
+        if (!postings_compressed_) {
+            const auto& postings = posting_list.postings;
+            auto it = lower_bound(postings.begin(), postings.end(), first, [](const Posting& posting, int ordinal) {
+                return posting.ordinal < ordinal;
+                });
+            for (; it != postings.end() && it->ordinal < last; ++it) {
+                func(it->ordinal, it->tf);
+            }
+            return;
+        }
+        posting_list.compressed.ForEachInRange(first, last, [this, &func](int ordinal, int count) {
+            func(ordinal, count * 1.0 / word_counts_[ordinal]);
+            });
+    }
+
+    //при равных релевантности и рейтинге выше документ с меньшим id, как было при полной сортировке
+    static bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+        if (abs(lhs.relevance - rhs.relevance) < EPSILON) {
+            return lhs.rating > rhs.rating || (lhs.rating == rhs.rating && lhs.id < rhs.id);
+        }
+        return lhs.relevance > rhs.relevance;
+    }
+
+    static int ComputeAverageRating(const vector<int>& rating) {
+        if (rating.empty()) {
+            return 0;
+        }
+        return accumulate(rating.begin(), rating.end(), 0) / static_cast<int>(rating.size());
+    }
+
+    bool IsStopWord(string_view word) const {
+        return stop_words_.count(word) > 0;
+    }
+
+    //результат и промежуточный список слов выделяются из scratch - временной памяти одного документа
+    optional<pmr::map<string_view, int>> SplitIntoWordsNoStop(string_view text, pmr::memory_resource* scratch) const {
+        pmr::map<string_view, int> result(scratch);
+        pmr::vector<string_view> words(scratch);
+        SplitIntoWords(text, words);
+        for (const string_view word : words) {
+            if (!IsStopWord(word)) {
+                ++result[word];
+            }
+        }
+        return result;
+
+    }
+
+    //слова запроса не копируются: Query хранит string_view в text. Все вектора разбора берутся из scratch -
+    //буфера на стеке FindTopDocuments/MatchDocument, который освобождается целиком в конце запроса
+    //+слово - обязательное слово. "фраза в кавычках" - все ее слова обязательны: позиций слов в индексе нет,
+    //поэтому фраза проверяется как AND своих слов без учета порядка
+    Query ParseQuery(string_view text, pmr::memory_resource* scratch) const {
+        PROFILE_QUERY_STAGE(QueryStage::PARSE);
+        Query query{ pmr::vector<string_view>(scratch), pmr::vector<string_view>(scratch), pmr::vector<string_view>(scratch) };
+        pmr::vector<string_view> words(scratch);
+        SplitIntoWords(text, words);
+        bool in_phrase = false;
+        for (string_view word : words) {
+            bool phrase_word = in_phrase;
+            if (!in_phrase && word.front() == '"') {
+                in_phrase = phrase_word = true;
+                word.remove_prefix(1);
+            }
+            if (in_phrase && !word.empty() && word.back() == '"') {
+                in_phrase = false;
+                word.remove_suffix(1);
+            }
+            if (word.empty() || IsStopWord(word)) {
+                continue;
+            }
+            if (phrase_word) {
+                query.required.push_back(word);
+                query.plus.push_back(word);
+            }
+            else if (word.at(0) == '+') {
+                if (word.size() == 1 || word.at(1) == '+' || word.at(1) == '-') {
+                    throw invalid_argument("Query with invalid \"+\"");
+                }
+                if (IsStopWord(word.substr(1))) {
+                    continue;
                 }
+                query.required.push_back(word.substr(1));
+                query.plus.push_back(word.substr(1));
+            }
+            else if (word.at(0) == '-') {
+                if (word.size() == 1 || word.at(1) == '-') {
+                    throw invalid_argument("Query with invalid \"-\" or \"---\"");
+                }
+                query.minus.push_back(word.substr(1)); //минус-слова берутся без знака
+            }
+            else {
+                query.plus.push_back(word);
             }
-            stop_words_.insert(word);
         }
-    }
 
-    explicit SearchServer(const string& s) {
-        SetStopWords(s);
-    }
+        if (in_phrase) {
+            throw invalid_argument("Query with unclosed quote");
+        }
 
-    void SetStopWords(const string& text) {
-        for (const string& word : SplitIntoWords(text)) {
-            stop_words_.insert(word);
+        for (auto* words : { &query.plus, &query.minus, &query.required }) {
+            sort(words->begin(), words->end());
+            words->erase(unique(words->begin(), words->end()), words->end());
         }
-    }
 
-    void AddDocument(int document_id, const string& document, DocumentStatus status, vector<int> rating) {
-        const auto words_freq = SplitIntoWordsNoStop(document); // map{word,TF}
+        return query;
+    }
 
+    //relevance[номер] += TF * IDF по плюс-словам, matched[номер] = 1 у документов с плюс-словами и без минус-слов.
+    //Номера с релевантностью попадают в touched по одному разу: до минус-слов matched[номер] == 0 значит первое касание.
+    //Возвращает количество номеров в touched
+    size_t ScoreDocuments(const Query& query_words, vector<double>& relevance, vector<char>& matched, vector<int>& touched) const {
+        PROFILE_QUERY_STAGE(QueryStage::SCORE);
+        size_t touched_count = 0;
+        for (const auto plus_word : query_words.plus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(plus_word);
+            if (word_it != index_->words_to_docs_with_freq.end()) {
+                //IDF считается один раз на слово, цикл по posting list - только умножение и сложение
+                const double idf = CalculateIDF(word_it->second);
+                ForEachPosting(word_it->second, [&relevance, &matched, &touched, &touched_count, idf](int ordinal, double tf) {
+                    relevance[ordinal] += tf * idf;  //relevance = tf * idf
+                    touched[touched_count] = ordinal;
+                    touched_count += matched[ordinal] == 0;
+                    matched[ordinal] = 1;
+                    });
+            }
 
-        if (document_id < 0) {
-            throw invalid_argument("Try to add document with negative id");
-        }
-        //проверка по id_to_rating т.к поиск по map быстрее чем по вектору
-        if (id_to_rating_.count(document_id)) {
-            throw invalid_argument("Try to add document with existing id");
         }
-        document_ids_.push_back(document_id);
-        id_to_rating_[document_id] = ComputeAverageRating(rating);
-        id_to_status_[document_id] = status;
 
-        //реализация SplitIntoWordsNoStop изменена, возвращает map{слово,количество повторов слова в документе},
-        //поэтому для расчета суммарного количества слов используется accumulate
-        int total_words = accumulate(words_freq.value().begin(), words_freq.value().end(), 0, [](int sum, const pair<string, int>& next) {
-            return sum + next.second;
+        ForEachMinusPosting(query_words, [&matched](int ordinal) {
+            matched[ordinal] = 0;
             });
+        return touched_count;
+    }
 
-        for (const auto& word : words_freq.value()) {
-            words_to_docs_with_freq[word.first][document_id] = word.second * 1.0 / total_words;
+    //релевантность копится в плотном массиве по номеру документа, найденные номера отмечаются в matched
+    template <typename Filter>
+    vector<Document> FindAllDocuments(const execution::sequenced_policy&, const Query& query_words, Filter conditions, size_t top_k) const {
+        //при небольшом top_k почти все документы заведомо не попадают в результат, их выгоднее отсекать;
+        //у длинных запросов каждый кандидат обходит все курсоры, и плотный массив оказывается быстрее
+        if (top_k <= PRUNING_MAX_TOP_K && query_words.plus.size() <= PRUNING_MAX_PLUS_WORDS) {
+            return FindTopDocumentsMaxScore(query_words, conditions, top_k);
+        }
+        DenseScratch& scratch = GetDenseScratch(ordinal_to_id_.size());
+        auto& relevance = scratch.relevance;
+        auto& matched = scratch.matched;
+        auto& touched = scratch.touched;
+        const size_t touched_count = ScoreDocuments(query_words, relevance, matched, touched);
+        const auto touched_end = touched.begin() + touched_count;
+
+        vector<Document> top_documents;
+        try {
+            PROFILE_QUERY_STAGE(QueryStage::FILTER);
+            const auto add_and_reset = [&](int ordinal) {
+                if (matched[ordinal]) {
+                    AddToTop(top_documents, ordinal, relevance[ordinal], conditions, top_k);
+                    matched[ordinal] = 0;
+                }
+                relevance[ordinal] = 0;
+            };
+            //документы идут в кучу по возрастанию номера, как и при сплошном проходе
+            if (touched_count * DENSE_SCAN_RATIO < ordinal_to_id_.size()) {
+                sort(touched.begin(), touched_end);
+                for_each(touched.begin(), touched_end, add_and_reset);
+            }
+            else {
+                for (size_t ordinal = 0; ordinal < ordinal_to_id_.size(); ++ordinal) {
+                    add_and_reset(static_cast<int>(ordinal));
+                }
+            }
+        }
+        catch (...) {
+            //исключение из фильтра: обнуляются все затронутые номера, чтобы не испортить следующий запрос
+            for_each(touched.begin(), touched_end, [&relevance, &matched](int ordinal) {
+                relevance[ordinal] = 0;
+                matched[ordinal] = 0;
+                });
+            throw;
         }
+        {
+            PROFILE_QUERY_STAGE(QueryStage::SORT);
+            sort_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+        return top_documents;
+    }
 
-        ++document_count_;
+    //то же для execution::par. Номера документов делятся на куски, каждый кусок - отдельная задача со своими плотными
+    //массивами: она берет из posting list только записи своих номеров, поэтому задачи не делят ни данных, ни блокировок.
+    //Возвращает по каждому куску пары {номер, релевантность} документов с плюс-словами и без минус-слов по возрастанию номера
+    vector<vector<pair<int, double>>> ScoreDocuments(const execution::parallel_policy&, const Query& query_words) const {
+        PROFILE_QUERY_STAGE(QueryStage::SCORE);
+        vector<pair<const PostingList*, double>> plus_lists;
+        for (const auto plus_word : query_words.plus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(plus_word);
+            if (word_it != index_->words_to_docs_with_freq.end()) {
+                plus_lists.emplace_back(&word_it->second, CalculateIDF(word_it->second));
+            }
+        }
+        vector<const PostingList*> minus_lists;
+        for (const auto minus_word : query_words.minus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(minus_word);
+            if (word_it != index_->words_to_docs_with_freq.end()) {
+                minus_lists.push_back(&word_it->second);
+            }
+        }
+        if (plus_lists.empty()) {
+            return {};
+        }
+
+        const size_t ordinal_count = ordinal_to_id_.size();
+        const size_t chunk_count = min(ordinal_count, static_cast<size_t>(max(1u, thread::hardware_concurrency()) * 4));
+        vector<vector<pair<int, double>>> chunk_documents(chunk_count);
+        vector<size_t> chunks(chunk_count);
+        iota(chunks.begin(), chunks.end(), 0);
+        for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+            const int first = static_cast<int>(chunk * ordinal_count / chunk_count);
+            const int last = static_cast<int>((chunk + 1) * ordinal_count / chunk_count);
+            vector<double> relevance(last - first);
+            vector<char> matched(last - first);
+            for (const auto& [posting_list, idf] : plus_lists) {
+                ForEachPostingInRange(*posting_list, first, last, [&relevance, &matched, first, idf = idf](int ordinal, double tf) {
+                    relevance[ordinal - first] += tf * idf;  //relevance = tf * idf
+                    matched[ordinal - first] = 1;
+                    });
+            }
+            for (const PostingList* posting_list : minus_lists) {
+                ForEachPostingInRange(*posting_list, first, last, [&matched, first](int ordinal, double) {
+                    matched[ordinal - first] = 0;
+                    });
+            }
+            auto& documents = chunk_documents[chunk];
+            for (int ordinal = first; ordinal < last; ++ordinal) {
+                if (matched[ordinal - first]) {
+                    documents.emplace_back(ordinal, relevance[ordinal - first]);
+                }
+            }
+            });
+        return chunk_documents;
     }
 
+    //par_unseq считается так же, как par: куски и так идут параллельно, а запись по номеру из posting list не векторизуется
     template <typename Filter>
-    vector<Document> FindTopDocuments(const string& raw_query, Filter conditions) const {
-        const auto query_words = ParseQuery(raw_query);
+    vector<Document> FindAllDocuments(const execution::parallel_unsequenced_policy&, const Query& query_words, Filter conditions, size_t top_k) const {
+        return FindAllDocuments(execution::par, query_words, conditions, top_k);
+    }
 
-        auto result = FindAllDocuments(query_words, conditions);
+    //релевантность считается параллельно по кускам номеров, так что на несколько ядер раскладывается даже запрос
+    //из одного слова с длинным posting list. Фильтр вызывается из этого потока, по возрастанию номера, как в seq
+    template <typename Filter>
+    vector<Document> FindAllDocuments(const execution::parallel_policy&, const Query& query_words, Filter conditions, size_t top_k) const {
+        const auto chunk_documents = ScoreDocuments(execution::par, query_words);
+
+        vector<Document> top_documents;
+        {
+            PROFILE_QUERY_STAGE(QueryStage::FILTER);
+            for (const auto& documents : chunk_documents) {
+                for (const auto& [ordinal, relevance] : documents) {
+                    AddToTop(top_documents, ordinal, relevance, conditions, top_k);
+                }
+            }
+        }
+        {
+            PROFILE_QUERY_STAGE(QueryStage::SORT);
+            sort_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+        return top_documents;
+    }
 
-        sort(result.begin(), result.end(),
-            [](const Document& lhs, const Document& rhs) {
-                return lhs.relevance > rhs.relevance ||
-                    (abs(lhs.relevance - rhs.relevance) < EPSILON && lhs.rating > rhs.rating);
-            });
+    //курсор по posting list в любом представлении. В несжатом списке SkipTo ищет галопом: шаг удваивается,
+    //пока не перескочит нужный номер, затем бинарный поиск, поэтому пропуск k записей стоит O(log k)
+    class PostingCursor {
+    public:
+        PostingCursor(const SearchServer& server, const PostingList& posting_list)
+            : server_(&server)
+            , posting_list_(&posting_list) {
+            if (server.postings_compressed_) {
+                cursor_.emplace(posting_list.compressed);
+            }
+        }
 
-        if (result.size() > MAX_RESULT_DOCUMENT_COUNT) {
-            result.resize(MAX_RESULT_DOCUMENT_COUNT);
+        size_t GetSize() const {
+            return server_->GetPostingCount(*posting_list_);
         }
 
-        return result;
-    }
-    //status template specification
+        bool AtEnd() const {
+            return cursor_ ? cursor_->AtEnd() : position_ >= posting_list_->postings.size();
+        }
 
-    vector<Document> FindTopDocuments(const string& raw_query, DocumentStatus needed_status = DocumentStatus::ACTUAL) const {
-        return FindTopDocuments(raw_query, [needed_status](int document_id, DocumentStatus status, int rating) {
-            return status == needed_status;
-            });
-    }
+        int Ordinal() const {
+            return cursor_ ? cursor_->Ordinal() : posting_list_->postings[position_].ordinal;
+        }
 
-    int GetDocumentCount() const {
-        return document_count_;
-    }
+        //так же, как в ForEachPosting
+        double GetTF() const {
+            if (cursor_) {
+                return cursor_->Count() * 1.0 / server_->word_counts_[cursor_->Ordinal()];
+            }
+            return posting_list_->postings[position_].tf;
+        }
+
+        //переход к первой записи с номером >= ordinal
+        void SkipTo(int ordinal) {
+            if (cursor_) {
+                cursor_->SkipTo(ordinal);
+                return;
+            }
+            const auto& postings = posting_list_->postings;
+            if (position_ >= postings.size() || postings[position_].ordinal >= ordinal) {
+                return;
+            }
+            size_t low = position_;
+            size_t step = 1;
+            while (low + step < postings.size() && postings[low + step].ordinal < ordinal) {
+                low += step;
+                step *= 2;
+            }
+            const auto high = postings.begin() + min(low + step, postings.size());
+            position_ = lower_bound(postings.begin() + low + 1, high, ordinal, [](const Posting& posting, int value) {
+                return posting.ordinal < value;
+                }) - postings.begin();
+        }
 
-    tuple<vector<string>, DocumentStatus> MatchDocument(const string& raw_query, int document_id) const {
-        set<string> matched_words;
-        const auto query_words = ParseQuery(raw_query);
+    private:
+        const SearchServer* server_;
+        const PostingList* posting_list_;
+        size_t position_ = 0;
+        optional<CompressedPostingList::Cursor> cursor_;
+    };
 
-        for (const auto& word : query_words.plus) {
-            if (words_to_docs_with_freq.count(word) && words_to_docs_with_freq.at(word).count(document_id)) {
-                matched_words.insert(word);
+    //документы со всеми обязательными словами: posting list пересекаются от самого короткого, остальные
+    //курсоры только догоняют кандидата через SkipTo. Минус-слова и релевантность проверяются тоже только
+    //для найденных кандидатов. Релевантность суммируется по плюс-словам в том же порядке, что в FindAllDocuments
+    template <typename Filter>
+    vector<Document> FindRequiredDocuments(const Query& query_words, Filter conditions, size_t top_k) const {
+        vector<PostingCursor> required;
+        for (const auto word : query_words.required) {
+            const auto word_it = index_->words_to_docs_with_freq.find(word);
+            if (word_it == index_->words_to_docs_with_freq.end()) {
+                return {};
             }
+            required.emplace_back(*this, word_it->second);
         }
+        sort(required.begin(), required.end(), [](const PostingCursor& lhs, const PostingCursor& rhs) {
+            return lhs.GetSize() < rhs.GetSize();
+        });
+
+        vector<int> candidates;
+        {
+            PROFILE_QUERY_STAGE(QueryStage::SCORE);
+            auto& smallest = required.front();
+            while (!smallest.AtEnd()) {
+                const int candidate = smallest.Ordinal();
+                int next_candidate = candidate;
+                for (size_t i = 1; i < required.size() && next_candidate == candidate; ++i) {
+                    required[i].SkipTo(candidate);
+                    next_candidate = required[i].AtEnd() ? numeric_limits<int>::max() : required[i].Ordinal();
+                }
+                if (next_candidate == candidate) {
+                    candidates.push_back(candidate);
+                    ++next_candidate;
+                }
+                if (next_candidate == numeric_limits<int>::max()) {
+                    break;
+                }
+                smallest.SkipTo(next_candidate);
+            }
 
-        for (const auto& word : query_words.minus) {
-            if (words_to_docs_with_freq.count(word) && words_to_docs_with_freq.at(word).count(document_id)) {
-                matched_words.clear();
+            for (const auto word : query_words.minus) {
+                const auto word_it = index_->words_to_docs_with_freq.find(word);
+                if (word_it == index_->words_to_docs_with_freq.end()) {
+                    continue;
+                }
+                PostingCursor minus(*this, word_it->second);
+                candidates.erase(remove_if(candidates.begin(), candidates.end(), [&minus](int ordinal) {
+                    minus.SkipTo(ordinal);
+                    return !minus.AtEnd() && minus.Ordinal() == ordinal;
+                    }), candidates.end());
             }
         }
 
-        vector<string> matched_words_vector;
+        vector<double> relevance(candidates.size());
+        for (const auto word : query_words.plus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(word);
+            if (word_it == index_->words_to_docs_with_freq.end()) {
+                continue;
+            }
+            const double idf = CalculateIDF(word_it->second);
+            PostingCursor cursor(*this, word_it->second);
+            for (size_t i = 0; i < candidates.size() && !cursor.AtEnd(); ++i) {
+                cursor.SkipTo(candidates[i]);
+                if (!cursor.AtEnd() && cursor.Ordinal() == candidates[i]) {
+                    relevance[i] += cursor.GetTF() * idf;
+                }
+            }
+        }
 
-        for (const auto& word : matched_words) {
-            matched_words_vector.push_back(word);
+        vector<Document> top_documents;
+        {
+            PROFILE_QUERY_STAGE(QueryStage::FILTER);
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                AddToTop(top_documents, candidates[i], relevance[i], conditions, top_k);
+            }
+        }
+        {
+            PROFILE_QUERY_STAGE(QueryStage::SORT);
+            sort_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
         }
+        return top_documents;
+    }
 
-        sort(matched_words_vector.begin(), matched_words_vector.end());
+    //отбор top_k с отсечением MaxScore. Слова упорядочены по верхней границе вклада max_tf * IDF; если сумма границ
+    //нескольких младших слов меньше релевантности худшего документа в куче, документ только с этими словами в кучу
+    //уже не попадет, поэтому кандидаты берутся лишь из списков остальных (существенных) слов, а младшие списки
+    //только догоняют кандидата через SkipTo. Документы идут по возрастанию номера, как в плотном обходе, и
+    //отсекаются, только если AddToTop для них ничего бы не сделал, поэтому результат совпадает с полным подсчетом
+    template <typename Filter>
+    vector<Document> FindTopDocumentsMaxScore(const Query& query_words, Filter& conditions, size_t top_k) const {
+        struct Term {
+            PostingCursor cursor;
+            double idf;
+            double upper_bound;
+        };
+        //вспомогательные массивы живут в стековом буфере запроса, как и сам Query
+        pmr::memory_resource* scratch = query_words.plus.get_allocator().resource();
+        //terms в порядке плюс-слов запроса - в нем же суммируется релевантность
+        pmr::vector<Term> terms(scratch);
+        for (const auto word : query_words.plus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(word);
+            if (word_it != index_->words_to_docs_with_freq.end()) {
+                const double idf = CalculateIDF(word_it->second);
+                terms.push_back({ PostingCursor(*this, word_it->second), idf, word_it->second.max_tf * idf });
+            }
+        }
+        pmr::vector<PostingCursor> minus_cursors(scratch);
+        for (const auto word : query_words.minus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(word);
+            if (word_it != index_->words_to_docs_with_freq.end()) {
+                minus_cursors.emplace_back(*this, word_it->second);
+            }
+        }
 
-        if (matched_words_vector.size() > MAX_RESULT_DOCUMENT_COUNT) {
-            matched_words_vector.resize(MAX_RESULT_DOCUMENT_COUNT);
+        pmr::vector<size_t> by_bound(terms.size(), scratch);
+        iota(by_bound.begin(), by_bound.end(), 0);
+        sort(by_bound.begin(), by_bound.end(), [&terms](size_t lhs, size_t rhs) {
+            return terms[lhs].upper_bound < terms[rhs].upper_bound;
+            });
+        //bound_prefix[i] - сумма границ слов by_bound[0..i]
+        pmr::vector<double> bound_prefix(terms.size(), scratch);
+        double bound_sum = 0;
+        for (size_t i = 0; i < by_bound.size(); ++i) {
+            bound_sum += terms[by_bound[i]].upper_bound;
+            bound_prefix[i] = bound_sum;
         }
 
+        vector<Document> top_documents;
+        {
+            //фильтр проверяется в AddToTop вперемешку с подсчетом, поэтому отдельной стадии FILTER здесь нет
+            PROFILE_QUERY_STAGE(QueryStage::SCORE);
+            int next_ordinal = 0;
+            while (true) {
+                //худший документ полной кучи задает порог: документ с релевантностью ниже порога на EPSILON
+                //не вытеснит его при любом рейтинге
+                size_t essential = 0;
+                const bool top_is_full = top_k > 0 && top_documents.size() == top_k;
+                const double threshold = top_is_full ? top_documents.front().relevance - EPSILON : 0;
+                if (top_is_full) {
+                    while (essential < terms.size() && bound_prefix[essential] < threshold) {
+                        ++essential;
+                    }
+                }
+
+                int candidate = numeric_limits<int>::max();
+                for (size_t i = essential; i < terms.size(); ++i) {
+                    auto& cursor = terms[by_bound[i]].cursor;
+                    cursor.SkipTo(next_ordinal);
+                    if (!cursor.AtEnd()) {
+                        candidate = min(candidate, cursor.Ordinal());
+                    }
+                }
+                if (candidate == numeric_limits<int>::max()) {
+                    break;
+                }
+                next_ordinal = candidate + 1;
+
+                const auto at_candidate = [candidate](const PostingCursor& cursor) {
+                    return !cursor.AtEnd() && cursor.Ordinal() == candidate;
+                };
+                if (top_is_full) {
+                    double bound = essential > 0 ? bound_prefix[essential - 1] : 0;
+                    for (size_t i = essential; i < terms.size(); ++i) {
+                        const Term& term = terms[by_bound[i]];
+                        if (at_candidate(term.cursor)) {
+                            bound += term.cursor.GetTF() * term.idf;
+                        }
+                    }
+                    //младшие слова уточняют оценку от старшего к младшему, пока она не опустится ниже порога
+                    for (size_t i = essential; i > 0 && bound >= threshold; --i) {
+                        Term& term = terms[by_bound[i - 1]];
+                        bound -= term.upper_bound;
+                        term.cursor.SkipTo(candidate);
+                        if (at_candidate(term.cursor)) {
+                            bound += term.cursor.GetTF() * term.idf;
+                        }
+                    }
+                    if (bound < threshold) {
+                        continue;
+                    }
+                }
 
-        return { matched_words_vector, id_to_status_.at(document_id) };
+                double relevance = 0;
+                for (Term& term : terms) {
+                    term.cursor.SkipTo(candidate);
+                    if (at_candidate(term.cursor)) {
+                        relevance += term.cursor.GetTF() * term.idf;
+                    }
+                }
+                const bool has_minus_word = any_of(minus_cursors.begin(), minus_cursors.end(), [&](PostingCursor& cursor) {
+                    cursor.SkipTo(candidate);
+                    return at_candidate(cursor);
+                    });
+                if (!has_minus_word) {
+                    AddToTop(top_documents, candidate, relevance, conditions, top_k);
+                }
+            }
+        }
+        {
+            PROFILE_QUERY_STAGE(QueryStage::SORT);
+            sort_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+        return top_documents;
     }
 
-    int GetDocumentId(int index)const {
-        if (index < 0 || index >= static_cast<int>(document_ids_.size())) {
-            throw out_of_range("Invalid index");
+    template <typename Func>
+    void ForEachMinusPosting(const Query& query_words, Func func) const {
+        for (const auto minus_word : query_words.minus) {
+            const auto word_it = index_->words_to_docs_with_freq.find(minus_word);
+            if (word_it != index_->words_to_docs_with_freq.end()) {
+                ForEachPosting(word_it->second, [&func](int ordinal, double) {
+                    func(ordinal);
+                    });
+            }
         }
-        return document_ids_.at(index);
     }
 
-private:
-
-    map<string, map<int, double>> words_to_docs_with_freq; //map{слово,map{id,TF}}
-
-    set<string> stop_words_;
-
-    map<int, int> id_to_rating_;
+    //фильтр и отбор top_k лучших совмещены: держим кучу из top_k документов, на вершине худший из них,
+    //поэтому полная сортировка всех найденных документов не нужна. После всех вызовов нужен sort_heap
+    template <typename Filter>
+    void AddToTop(vector<Document>& top_documents, int ordinal, double relevance, Filter& conditions, size_t top_k) const {
+        if (top_k == 0 || !conditions(ordinal_to_id_[ordinal], statuses_[ordinal], ratings_[ordinal])) {
+            return;
+        }
+        const Document document{ ordinal_to_id_[ordinal], relevance, ratings_[ordinal] };
+        if (top_documents.size() < top_k) {
+            top_documents.push_back(document);
+            push_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+        else if (IsMoreRelevant(document, top_documents.front())) {
+            pop_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+            top_documents.back() = document;
+            push_heap(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+        }
+    }
+};
 
-    map<int, DocumentStatus> id_to_status_;
+//ввод без iostream: файл отображается через mmap, а FILE* (например, stdin) читается кусками по chunk_size
+//по мере надобности. Строки возвращаются как string_view в эти данные. Из файла они живут, пока жив BulkReader,
+//из FILE* - до вызова ReleaseLines: куски, на которые больше не ссылается ни одна строка, тогда освобождаются
+class BulkReader {
+public:
+    static const size_t INPUT_CHUNK_SIZE = 1 << 20;
 
-    vector<int> document_ids_;
+    //file должен оставаться открытым, пока из BulkReader читаются строки
+    explicit BulkReader(FILE* file, size_t chunk_size = INPUT_CHUNK_SIZE)
+        : input_(file)
+        , chunk_size_(max<size_t>(chunk_size, 1)) {
+    }
 
-    int document_count_ = 0;
+    explicit BulkReader(const string& path)
+        : file_(make_unique<MappedFile>(path))
+        , data_(file_->data(), file_->size()) {
+    }
 
-    // Existence required
-    double CalculateIDF(const string& word) const {
-        return log(document_count_ * 1.0 / words_to_docs_with_freq.at(word).size());
+    bool AtEnd() {
+        return position_ >= data_.size() && !ReadChunk();
     }
 
-    static int ComputeAverageRating(const vector<int>& rating) {
-        if (rating.empty()) {
-            return 0;
+    string_view ReadLine() {
+        if (AtEnd()) {
+            return {};
         }
-        return accumulate(rating.begin(), rating.end(), 0) / static_cast<int>(rating.size());
+        size_t line_end = data_.find('\n', position_);
+        //строка не закончилась в текущем куске: ее начало переносится в следующий
+        while (line_end == string_view::npos) {
+            const size_t searched = data_.size() - position_;
+            if (!ReadChunk()) {
+                line_end = data_.size();
+                break;
+            }
+            line_end = data_.find('\n', position_ + searched);
+        }
+        string_view line = data_.substr(position_, line_end - position_);
+        position_ = line_end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        return line;
     }
 
-    bool IsStopWord(const string& word) const {
-        return stop_words_.count(word) > 0;
+    int ReadLineWithNumber() {
+        string_view line = ReadLine();
+        return ParseNumber(line);
     }
 
-    optional<map<string, int>> SplitIntoWordsNoStop(const string& text) const {
-        map<string, int> result;
-        for (const string& word : SplitIntoWords(text)) {
-            if (!IsStopWord(word)) {
-                ++result[word];
-            }
+    //строки, прочитанные до вызова, больше не нужны: при чтении из FILE* их куски освобождаются,
+    //так что в памяти одновременно лежит только текущий кусок и строки после последнего ReleaseLines
+    void ReleaseLines() {
+        while (chunks_.size() > 1) {
+            chunks_.pop_front();
+        }
+    }
+
+    //число в начале text, text сдвигается за него
+    static int ParseNumber(string_view& text) {
+        while (!text.empty() && text.front() == ' ') {
+            text.remove_prefix(1);
         }
+        int result = 0;
+        const auto [end, error] = from_chars(text.data(), text.data() + text.size(), result);
+        if (error != errc()) {
+            throw invalid_argument("Invalid number in input");
+        }
+        text.remove_prefix(end - text.data());
         return result;
+    }
 
+private:
+    FILE* input_ = nullptr;
+    size_t chunk_size_ = INPUT_CHUNK_SIZE;
+    //deque не перемещает куски при добавлении, строки из старых кусков остаются действительными
+    deque<string> chunks_;
+    unique_ptr<MappedFile> file_;
+    string_view data_;
+    size_t position_ = 0;
+
+    //новый кусок начинается с непрочитанного остатка текущего; false, если поток закончился
+    bool ReadChunk() {
+        if (input_ == nullptr) {
+            return false;
+        }
+        const string_view rest = data_.substr(min(position_, data_.size()));
+        string chunk(max(chunk_size_, 2 * rest.size()), '\0');
+        rest.copy(chunk.data(), rest.size());
+        const size_t read = fread(chunk.data() + rest.size(), 1, chunk.size() - rest.size(), input_);
+        if (read == 0) {
+            input_ = nullptr;
+            return false;
+        }
+        chunk.resize(rest.size() + read);
+        chunks_.push_back(move(chunk));
+        data_ = chunks_.back();
+        position_ = 0;
+        return true;
     }
+};
 
-    Query ParseQuery(const string& text) const {
-        set<string> plus_words;
-        set<string> minus_words;
-        if (auto words = SplitIntoWordsNoStop(text)) {
-            for (const auto& [word, freq] : words.value()) {
-                if (word.at(0) == '-') {
-                    if (word.size() == 1 || word.at(1) == '-') {
-                        throw invalid_argument("Query with invalid \"-\" or \"---\"");
-                    }
-                    minus_words.insert(word.substr(1)); //минус-слова берутся без знака
-                }
-                else {
-                    plus_words.insert(word);
-                }
-            }
+//формат ввода: строка стоп-слов, строка с количеством документов, затем для каждого документа строка текста
+//и строка "количество_оценок оценка1 оценка2 ...". Документы получают id по порядку с 0 и добавляются пачками
+SearchServer CreateSearchServer(BulkReader& input, size_t batch_size = 10000) {
+    SearchServer search_server(input.ReadLine());
+    const int document_count = input.ReadLineWithNumber();
+
+    vector<RawDocument> batch;
+    batch.reserve(min<size_t>(batch_size, max(document_count, 0)));
+    for (int document_id = 0; document_id < document_count; ++document_id) {
+        RawDocument document;
+        document.id = document_id;
+        document.text = input.ReadLine();
+        string_view ratings_line = input.ReadLine();
+        const int rating_count = BulkReader::ParseNumber(ratings_line);
+        //каждой оценке нужен пробел и хотя бы одна цифра, больше в остаток строки не поместится
+        if (rating_count < 0 || static_cast<size_t>(rating_count) > ratings_line.size() / 2) {
+            throw invalid_argument("Invalid ratings count in input");
         }
+        document.ratings.resize(rating_count);
+        for (int& rating : document.ratings) {
+            rating = BulkReader::ParseNumber(ratings_line);
+        }
+        batch.push_back(move(document));
 
-        return { plus_words,minus_words };
+        if (batch.size() == batch_size) {
+            search_server.AddDocuments(execution::par, batch);
+            batch.clear();
+            //слова пачки уже скопированы в словарь, ее текст больше не нужен
+            input.ReleaseLines();
+        }
     }
+    search_server.AddDocuments(execution::par, batch);
 
+    return search_server;
+}
 
-    template <typename Filter>
-    vector<Document> FindAllDocuments(const Query& query_words, Filter conditions) const {
-        vector<Document> matched_documents;
-        map<int, double> potential_documents;
+//запросы пачки выполняются параллельно, индекс на это время только читается
+vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<string>& queries) {
+    vector<vector<Document>> result(queries.size());
+    transform(execution::par, queries.begin(), queries.end(), result.begin(), [&search_server](const string& query) {
+        return search_server.FindTopDocuments(query);
+        });
+    return result;
+}
 
-        for (const auto& plus_word : query_words.plus) {
-            if (words_to_docs_with_freq.count(plus_word)) {
-                for (auto [id, tf] : words_to_docs_with_freq.at(plus_word)) {
-                    potential_documents[id] += (tf * CalculateIDF(plus_word));  //relevance = tf * idf
-                }
-            }
+//то же, что ProcessQueries, но результаты всех запросов идут подряд в одном векторе
+vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries) {
+    vector<Document> result;
+    for (auto& documents : ProcessQueries(search_server, queries)) {
+        result.insert(result.end(), documents.begin(), documents.end());
+    }
+    return result;
+}
 
+struct WordSetHasher {
+    size_t operator()(const vector<string_view>& words) const {
+        size_t hash = words.size();
+        for (const string_view word : words) {
+            hash = hash * 37 + hash_fn(word);
         }
+        return hash;
+    }
 
-        for (const auto& minus_word : query_words.minus) {
-            if (words_to_docs_with_freq.count(minus_word)) {
-                for (auto [id, _] : words_to_docs_with_freq.at(minus_word)) {
-                    potential_documents.erase(id);
-                }
-            }
-        }
+    hash<string_view> hash_fn;
+};
 
-        for (const auto& [id, rel] : potential_documents) {
-            if (conditions(id, id_to_status_.at(id), id_to_rating_.at(id))) {
-                const int rating = id_to_rating_.at(id);
-                matched_documents.push_back({ id,rel,rating });
-            }
+//дубликаты - документы с одинаковым набором слов (частоты не учитываются), остается документ с наименьшим id.
+//Набор слов каждого документа берется из прямого индекса уже отсортированным и хешируется целиком,
+//поэтому поиск идет за один проход без попарных сравнений
+//удаляет документы с тем же набором слов, что у документа с меньшим id, и возвращает удаленные id по возрастанию
+vector<int> RemoveDuplicates(SearchServer& search_server) {
+    vector<int> document_ids(search_server.begin(), search_server.end());
+    sort(document_ids.begin(), document_ids.end());
+
+    unordered_set<vector<string_view>, WordSetHasher> word_sets;
+    word_sets.reserve(document_ids.size());
+    vector<int> duplicates;
+    for (const int document_id : document_ids) {
+        vector<string_view> words;
+        for (const auto& [word, _] : search_server.GetWordFrequencies(document_id)) {
+            words.push_back(word);
+        }
+        if (!word_sets.insert(move(words)).second) {
+            duplicates.push_back(document_id);
         }
-
-        return matched_documents;
     }
-};
+
+    search_server.RemoveDocuments(execution::seq, duplicates);
+    return duplicates;
+}
 
 void PrintDocument(const Document& document, ostringstream& out) {
     out << "{ "s
@@ -369,95 +2499,293 @@ private:
     vector<IteratorRange<Iterator>> pages_;
 };
 
+//кэш результатов FindTopDocuments(raw_query, status) с вытеснением давно не использованных (LRU).
+//Ключ - нормализованный запрос и статус, поэтому "cat dog" и "dog cat cat" попадают в одну запись.
+//Запись хранит поколение индекса, при котором она посчитана; после AddDocument/RemoveDocument
+//записи устаревают и пересчитываются при следующем обращении. Кэш разбит на shard_count частей
+//со своим mutex, запросы к разным частям из разных потоков не мешают друг другу
+class QueryResultCache {
+public:
+    explicit QueryResultCache(const SearchServer& search_server, size_t capacity = 1024, size_t shard_count = 16)
+        : server_(search_server)
+        , shards_(shard_count) {
+        if (capacity == 0 || shard_count == 0) {
+            throw invalid_argument("QueryResultCache must have non-zero capacity and shard count");
+        }
+        shard_capacity_ = (capacity + shard_count - 1) / shard_count;
+    }
+
+    //сам поиск идет вне блокировки, поэтому одинаковые промахи из разных потоков могут посчитаться дважды
+    vector<Document> FindTopDocuments(string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL) {
+        string key = server_.NormalizeQuery(raw_query);
+        key += static_cast<char>('0' + static_cast<int>(status));
+        const uint64_t generation = server_.GetGeneration();
+        Shard& shard = shards_[hash<string>{}(key) % shards_.size()];
+        {
+            lock_guard guard(shard.guard);
+            const auto it = shard.positions.find(key);
+            if (it != shard.positions.end()) {
+                if (it->second->generation == generation) {
+                    //запись переносится в начало списка - самая свежая
+                    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+                    hit_count_.fetch_add(1, memory_order_relaxed);
+                    return it->second->result;
+                }
+                shard.entries.erase(it->second);
+                shard.positions.erase(it);
+            }
+        }
+        miss_count_.fetch_add(1, memory_order_relaxed);
+
+        auto result = server_.FindTopDocuments(raw_query, status);
+        lock_guard guard(shard.guard);
+        if (shard.positions.count(key) == 0) {
+            shard.entries.push_front({ key, generation, result });
+            shard.positions[move(key)] = shard.entries.begin();
+            if (shard.entries.size() > shard_capacity_) {
+                shard.positions.erase(shard.entries.back().key);
+                shard.entries.pop_back();
+            }
+        }
+        return result;
+    }
+
+    const SearchServer& GetServer() const {
+        return server_;
+    }
+
+    uint64_t GetHitCount() const {
+        return hit_count_.load(memory_order_relaxed);
+    }
+
+    uint64_t GetMissCount() const {
+        return miss_count_.load(memory_order_relaxed);
+    }
+
+    double GetHitRate() const {
+        const uint64_t hits = GetHitCount();
+        const uint64_t total = hits + GetMissCount();
+        return total == 0 ? 0 : hits * 1.0 / total;
+    }
+
+private:
+    struct Entry {
+        string key;
+        uint64_t generation = 0;
+        vector<Document> result;
+    };
+
+    //entries от самой свежей записи к самой старой, positions - место записи в списке по ключу
+    struct Shard {
+        mutex guard;
+        list<Entry> entries;
+        unordered_map<string, list<Entry>::iterator> positions;
+    };
+
+    const SearchServer& server_;
+    vector<Shard> shards_;
+    size_t shard_capacity_ = 0;
+    atomic<uint64_t> hit_count_{ 0 };
+    atomic<uint64_t> miss_count_{ 0 };
+};
+
+//статистика запросов за скользящее окно времени window, разбитое на корзины по bucket. Для каждой корзины хранятся
+//только атомарные счетчики (запросы, пустые результаты, сумма размеров результатов), поэтому AddFindRequest
+//можно вызывать из нескольких потоков без блокировок, а обновление - O(1). Статистика считается за последние
+//period <= window, например за минуту, час или сутки, с точностью до одной корзины
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server): server(search_server) {
-        // напишите реализацию
+    using Clock = chrono::steady_clock;
+
+    explicit RequestQueue(const SearchServer& search_server, Clock::duration window = chrono::hours(24),
+                          Clock::duration bucket = chrono::minutes(1), function<Clock::time_point()> now = [] {
+                              return Clock::now();
+                          })
+        : server(search_server)
+        , bucket_(bucket)
+        , now_(move(now))
+        , start_(now_()) {
+        if (bucket <= Clock::duration::zero() || window < bucket) {
+            throw invalid_argument("RequestQueue window must contain at least one bucket");
+        }
+        buckets_ = vector<Bucket>(window / bucket);
+    }
+
+    //запросы без предиката отвечаются из кэша, повторяющиеся запросы не пересчитываются
+    explicit RequestQueue(QueryResultCache& cache, Clock::duration window = chrono::hours(24),
+                          Clock::duration bucket = chrono::minutes(1), function<Clock::time_point()> now = [] {
+                              return Clock::now();
+                          })
+        : RequestQueue(cache.GetServer(), window, bucket, move(now)) {
+        cache_ = &cache;
     }
+
     // сделаем "обёртки" для всех методов поиска, чтобы сохранять результаты для нашей статистики
     template <typename DocumentPredicate>
     vector<Document> AddFindRequest(const string& raw_query, DocumentPredicate document_predicate) {
         auto result = server.FindTopDocuments(raw_query, document_predicate);
-        if (result.empty()) {
-            ++empty_requests_count_;
-        }
-        requests_.push_back(raw_query,result);
-
-        if (requests_.size() > 1440) {
-            if (requests_.front().result.empty()) {
-                --empty_requests_count_;
-            }
-            requests_.pop_front();
-        }
+        AddRequestStats(result.size());
         return result;
     }
-    vector<Document> AddFindRequest(const string& raw_query, DocumentStatus status) {
-        auto result = server.FindTopDocuments(raw_query, status);
-        if (result.empty()) {
-            ++empty_requests_count_;
-        }
-        requests_.push_back({raw_query, result});
 
-        if (requests_.size() > 1440) {
-            if (requests_.front().result.empty()) {
-                --empty_requests_count_;
-            }
-            requests_.pop_front();
-        }
+    vector<Document> AddFindRequest(const string& raw_query, DocumentStatus status) {
+        auto result = cache_ ? cache_->FindTopDocuments(raw_query, status) : server.FindTopDocuments(raw_query, status);
+        AddRequestStats(result.size());
         return result;
     }
+
     vector<Document> AddFindRequest(const string& raw_query) {
-        auto result = server.FindTopDocuments(raw_query);
-        if (result.empty()) {
-            ++empty_requests_count_;
+        auto result = cache_ ? cache_->FindTopDocuments(raw_query) : server.FindTopDocuments(raw_query);
+        AddRequestStats(result.size());
+        return result;
+    }
+
+    //period по умолчанию - все окно
+    int GetNoResultRequests(Clock::duration period = Clock::duration::max()) const {
+        return static_cast<int>(CollectStats(period).empty_requests);
+    }
+
+    uint64_t GetRequestCount(Clock::duration period = Clock::duration::max()) const {
+        return CollectStats(period).requests;
+    }
+
+    //доля запросов с непустым результатом
+    double GetHitRate(Clock::duration period = Clock::duration::max()) const {
+        const auto stats = CollectStats(period);
+        if (stats.requests == 0) {
+            return 0;
         }
-        requests_.push_back({raw_query, result});
+        return 1.0 - stats.empty_requests * 1.0 / stats.requests;
+    }
 
-        if (requests_.size() > 1440) {
-            if (requests_.front().result.empty()) {
-                --empty_requests_count_;
-            }
-            requests_.pop_front();
+    double GetAverageResultSize(Clock::duration period = Clock::duration::max()) const {
+        const auto stats = CollectStats(period);
+        if (stats.requests == 0) {
+            return 0;
         }
-        return result;
+        return stats.result_size_sum * 1.0 / stats.requests;
     }
-    int GetNoResultRequests() const {
-        return empty_requests_count_;
+
+    //запросов в секунду за period; за нулевое время скорость не определена, тогда 0
+    double GetQueriesPerSecond(Clock::duration period = Clock::duration::max()) const {
+        const auto stats = CollectStats(period);
+        if (stats.duration <= Clock::duration::zero()) {
+            return 0;
+        }
+        return stats.requests / chrono::duration<double>(stats.duration).count();
     }
+
 private:
-    const SearchServer& server;
-    struct QueryResult {
-        string query;
-        vector<Document> result;
+    //epoch - номер корзины от start_ + 1, которой сейчас принадлежат счетчики; 0 - корзина не использовалась
+    struct Bucket {
+        atomic<uint64_t> epoch{ 0 };
+        atomic<uint64_t> requests{ 0 };
+        atomic<uint64_t> empty_requests{ 0 };
+        atomic<uint64_t> result_size_sum{ 0 };
     };
-    deque<QueryResult> requests_;
-    const static int min_in_day_ = 1440;
-    size_t empty_requests_count_ = 0;
-};
 
-template <typename Container>
-auto Paginate(const Container& c, size_t page_size) {
-    return Paginator(begin(c), end(c), page_size);
-}
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t empty_requests = 0;
+        uint64_t result_size_sum = 0;
+        Clock::duration duration;
+    };
+
+    //epoch корзины, которую сейчас обнуляет другой поток
+    static const uint64_t RESETTING_EPOCH = numeric_limits<uint64_t>::max();
 
+    const SearchServer& server;
+    QueryResultCache* cache_ = nullptr;
+    Clock::duration bucket_;
+    function<Clock::time_point()> now_;
+    Clock::time_point start_;
+    vector<Bucket> buckets_;
+
+    uint64_t GetCurrentEpoch() const {
+        return static_cast<uint64_t>(max(now_() - start_, Clock::duration::zero()) / bucket_) + 1;
+    }
+
+    //первый поток нового отрезка времени забирает корзину через CAS и обнуляет счетчики, остальные ждут,
+    //пока он не выставит новый epoch. Запрос, опоздавший на целое окно, учитывается в более новой корзине
+    void AddRequestStats(size_t result_size) {
+        const uint64_t epoch = GetCurrentEpoch();
+        Bucket& bucket = buckets_[epoch % buckets_.size()];
+        uint64_t bucket_epoch = bucket.epoch.load(memory_order_acquire);
+        while (bucket_epoch < epoch || bucket_epoch == RESETTING_EPOCH) {
+            if (bucket_epoch != RESETTING_EPOCH && bucket.epoch.compare_exchange_weak(bucket_epoch, RESETTING_EPOCH, memory_order_acquire)) {
+                bucket.requests.store(0, memory_order_relaxed);
+                bucket.empty_requests.store(0, memory_order_relaxed);
+                bucket.result_size_sum.store(0, memory_order_relaxed);
+                bucket.epoch.store(epoch, memory_order_release);
+                break;
+            }
+            this_thread::yield();
+            bucket_epoch = bucket.epoch.load(memory_order_acquire);
+        }
+        bucket.requests.fetch_add(1, memory_order_relaxed);
+        if (result_size == 0) {
+            bucket.empty_requests.fetch_add(1, memory_order_relaxed);
+        }
+        bucket.result_size_sum.fetch_add(result_size, memory_order_relaxed);
+    }
+
+    //суммируются корзины последних period / bucket_ отрезков, включая текущий
+    Stats CollectStats(Clock::duration period) const {
+        const uint64_t bucket_count = period / bucket_ < static_cast<Clock::rep>(buckets_.size())
+            ? max<uint64_t>(period / bucket_, 1)
+            : buckets_.size();
+        const uint64_t epoch = GetCurrentEpoch();
+        Stats stats;
+        //полные корзины и прошедшая часть текущей, но не больше, чем очередь существует
+        const auto elapsed = max(now_() - start_, Clock::duration::zero());
+        stats.duration = min(bucket_ * static_cast<Clock::rep>(bucket_count - 1) + elapsed % bucket_, elapsed);
+        for (const Bucket& bucket : buckets_) {
+            const uint64_t bucket_epoch = bucket.epoch.load(memory_order_acquire);
+            if (bucket_epoch == 0 || bucket_epoch == RESETTING_EPOCH || bucket_epoch > epoch || epoch - bucket_epoch >= bucket_count) {
+                continue;
+            }
+            stats.requests += bucket.requests.load(memory_order_relaxed);
+            stats.empty_requests += bucket.empty_requests.load(memory_order_relaxed);
+            stats.result_size_sum += bucket.result_size_sum.load(memory_order_relaxed);
+        }
+        return stats;
+    }
+};
+
+//тесты и бенчмарк подключают этот файл целиком и задают SEARCH_SERVER_NO_MAIN, чтобы не было второго main
+#ifndef SEARCH_SERVER_NO_MAIN
 int main() {
     SearchServer search_server("and in at"s);
-    RequestQueue request_queue(search_server);
+    //окно - сутки по минутам, в демо запросы приходят раз в минуту
+    RequestQueue::Clock::time_point now;
+    RequestQueue request_queue(search_server, chrono::hours(24), chrono::minutes(1), [&now] {
+        return now;
+        });
+    const auto add_request = [&now, &request_queue](const string& raw_query) {
+        now += chrono::minutes(1);
+        request_queue.AddFindRequest(raw_query);
+    };
     search_server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
     search_server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
     search_server.AddDocument(3, "big cat fancy collar "s, DocumentStatus::ACTUAL, { 1, 2, 8 });
     search_server.AddDocument(4, "big dog sparrow Eugene"s, DocumentStatus::ACTUAL, { 1, 3, 2 });
     search_server.AddDocument(5, "big dog sparrow Vasiliy"s, DocumentStatus::ACTUAL, { 1, 1, 1 });
+    // те же слова, что у документа 1
+    search_server.AddDocument(6, "curly tail curly cat"s, DocumentStatus::ACTUAL, { 1, 2 });
+    for (const int document_id : RemoveDuplicates(search_server)) {
+        cout << "Found duplicate document id "s << document_id << endl;
+    }
     // 1439 запросов с нулевым результатом
     for (int i = 0; i < 1439; ++i) {
-        request_queue.AddFindRequest("empty request"s);
+        add_request("empty request"s);
     }
     // все еще 1439 запросов с нулевым результатом
-    request_queue.AddFindRequest("curly dog"s);
+    add_request("curly dog"s);
     // новые сутки, первый запрос удален, 1438 запросов с нулевым результатом
-    request_queue.AddFindRequest("big collar"s);
+    add_request("big collar"s);
     // первый запрос удален, 1437 запросов с нулевым результатом
-    request_queue.AddFindRequest("sparrow"s);
+    add_request("sparrow"s);
     cout << "Total empty requests: "s << request_queue.GetNoResultRequests() << endl;
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,959 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <execution>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#define SEARCH_SERVER_NO_MAIN
+#include "SearchServer.cpp"
+
+using namespace std;
+
+// -------- Счетчик обращений к глобальному аллокатору ----------
+
+atomic<size_t> allocation_count{ 0 };
+
+[[gnu::noinline]] void* operator new(size_t size) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    if (void* pointer = malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+//количество вызовов operator new за время func
+template <typename Func>
+size_t CountAllocations(Func func) {
+    const size_t before = allocation_count.load();
+    func();
+    return allocation_count.load() - before;
+}
+
+// -------- Генерация синтетического корпуса ----------
+
+vector<string> GenerateDictionary(mt19937& generator, int word_count, int max_length) {
+    const string letters = "abcdefghijklmnopqrstuvwxyz"s;
+    vector<string> words;
+    words.reserve(word_count);
+    for (int i = 0; i < word_count; ++i) {
+        const int length = uniform_int_distribution(1, max_length)(generator);
+        string word;
+        for (int j = 0; j < length; ++j) {
+            word += letters[uniform_int_distribution<int>(0, letters.size() - 1)(generator)];
+        }
+        words.push_back(word);
+    }
+    return words;
+}
+
+string GenerateText(mt19937& generator, const vector<string>& dictionary, int word_count) {
+    string text;
+    for (int i = 0; i < word_count; ++i) {
+        if (i > 0) {
+            text += ' ';
+        }
+        text += dictionary[uniform_int_distribution<int>(0, dictionary.size() - 1)(generator)];
+    }
+    return text;
+}
+
+template <typename Func>
+double MeasureSeconds(Func func) {
+    const auto start = chrono::steady_clock::now();
+    func();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//слова словаря с вероятностью, обратной рангу в степени exponent (закон Ципфа): как в живом тексте,
+//несколько слов встречаются почти везде, а большинство - редко
+class ZipfWordGenerator {
+public:
+    ZipfWordGenerator(vector<string> words, double exponent)
+        : words_(move(words)) {
+        double sum = 0;
+        for (size_t rank = 1; rank <= words_.size(); ++rank) {
+            sum += 1.0 / pow(rank, exponent);
+            cumulative_weights_.push_back(sum);
+        }
+    }
+
+    const string& operator()(mt19937& generator) const {
+        const double point = uniform_real_distribution(0.0, cumulative_weights_.back())(generator);
+        const size_t rank = upper_bound(cumulative_weights_.begin(), cumulative_weights_.end(), point) - cumulative_weights_.begin();
+        return words_[min(rank, words_.size() - 1)];
+    }
+
+private:
+    vector<string> words_;
+    vector<double> cumulative_weights_;
+};
+
+struct CorpusOptions {
+    int document_count = 100'000;
+    int document_length = 10;
+    int vocabulary_size = 20'000;
+    double zipf_exponent = 1.0;
+};
+
+//состав запросов: сколько слов и какая доля слов запроса - минус-слова, стоп-слова и обязательные +слова
+struct QueryMix {
+    int word_count = 3;
+    double minus_word_share = 0.2;
+    double stop_word_share = 0.1;
+    double required_word_share = 0.0;
+};
+
+const string BENCHMARK_STOP_WORDS = "and in at"s;
+
+vector<string> GenerateCorpus(mt19937& generator, const ZipfWordGenerator& words, const CorpusOptions& options) {
+    vector<string> documents;
+    documents.reserve(options.document_count);
+    for (int id = 0; id < options.document_count; ++id) {
+        string text;
+        for (int i = 0; i < options.document_length; ++i) {
+            text += words(generator);
+            text += ' ';
+        }
+        documents.push_back(move(text));
+    }
+    return documents;
+}
+
+vector<string> GenerateQueries(mt19937& generator, const ZipfWordGenerator& words, const QueryMix& mix, int query_count) {
+    const auto stop_words = SplitIntoWords(BENCHMARK_STOP_WORDS);
+    vector<string> queries;
+    for (int i = 0; i < query_count; ++i) {
+        string query;
+        for (int j = 0; j < mix.word_count; ++j) {
+            const double kind = uniform_real_distribution(0.0, 1.0)(generator);
+            if (kind < mix.stop_word_share) {
+                query += stop_words[uniform_int_distribution<size_t>(0, stop_words.size() - 1)(generator)];
+            }
+            else {
+                if (kind < mix.stop_word_share + mix.minus_word_share) {
+                    query += '-';
+                }
+                else if (kind < mix.stop_word_share + mix.minus_word_share + mix.required_word_share) {
+                    query += '+';
+                }
+                query += words(generator);
+            }
+            query += ' ';
+        }
+        queries.push_back(move(query));
+    }
+    return queries;
+}
+
+// -------- Мини-харнесс в духе Google Benchmark ----------
+
+//тело бенчмарка крутится в цикле while (state.KeepRunning()), время каждой итерации записывается отдельно.
+//Остановка - после max_iterations итераций или min_seconds секунд
+class BenchmarkState {
+public:
+    BenchmarkState(size_t max_iterations, double min_seconds)
+        : max_iterations_(max_iterations)
+        , min_duration_(chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(min_seconds))) {
+        latencies_.reserve(max_iterations);
+    }
+
+    bool KeepRunning() {
+        const auto now = chrono::steady_clock::now();
+        if (!started_) {
+            started_ = true;
+            start_ = now;
+            start_allocations_ = allocation_count.load();
+        }
+        else {
+            latencies_.push_back(now - iteration_start_);
+        }
+        if (latencies_.size() >= max_iterations_ || (now - start_ >= min_duration_ && !latencies_.empty())) {
+            allocations_ = allocation_count.load() - start_allocations_;
+            total_ = now - start_;
+            return false;
+        }
+        iteration_start_ = chrono::steady_clock::now();
+        return true;
+    }
+
+    size_t GetIteration() const {
+        return latencies_.size();
+    }
+
+    //items - сколько операций делает одна итерация, например запросов в пачке ProcessQueries
+    void SetItemsPerIteration(size_t items) {
+        items_per_iteration_ = items;
+    }
+
+    void Report(const string& name) {
+        sort(latencies_.begin(), latencies_.end());
+        const auto percentile = [this](double share) {
+            const size_t index = min(latencies_.size() - 1, static_cast<size_t>(share * latencies_.size()));
+            return chrono::duration<double, micro>(latencies_[index]).count();
+        };
+        const double operations = latencies_.size() * 1.0 * items_per_iteration_;
+        cout << left << setw(40) << name << right << setw(10) << latencies_.size()
+            << setw(14) << fixed << setprecision(0) << operations / chrono::duration<double>(total_).count()
+            << setprecision(2) << setw(11) << percentile(0.5) << setw(11) << percentile(0.9)
+            << setw(11) << percentile(0.99) << setw(12) << allocations_ / operations << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+
+    static void PrintHeader() {
+        cout << left << setw(40) << "Benchmark"s << right << setw(10) << "Iters"s << setw(14) << "Ops/s"s
+            << setw(11) << "p50 us"s << setw(11) << "p90 us"s << setw(11) << "p99 us"s << setw(12) << "Allocs/op"s << endl;
+    }
+
+private:
+    size_t max_iterations_;
+    chrono::steady_clock::duration min_duration_;
+    vector<chrono::steady_clock::duration> latencies_;
+    bool started_ = false;
+    chrono::steady_clock::time_point start_;
+    chrono::steady_clock::time_point iteration_start_;
+    chrono::steady_clock::duration total_{};
+    size_t start_allocations_ = 0;
+    size_t allocations_ = 0;
+    size_t items_per_iteration_ = 1;
+};
+
+//запуск выбирается подстрокой имени из командной строки, как --benchmark_filter
+struct BenchmarkRunner {
+    string filter;
+    size_t max_iterations = 100'000;
+    double min_seconds = 1.0;
+
+    bool IsSelected(const string& name) const {
+        return name.find(filter) != string::npos;
+    }
+
+    template <typename Func>
+    void Run(const string& name, Func func) const {
+        if (!IsSelected(name)) {
+            return;
+        }
+        BenchmarkState state(max_iterations, min_seconds);
+        func(state);
+        state.Report(name);
+    }
+};
+
+// -------- Старая раскладка индекса map<string, map<int, double>> для сравнения ----------
+
+// повторяет исходные FindAllDocuments + FindTopDocuments, отличается от SearchServer только раскладкой индекса
+size_t FindTopWithNestedMaps(const map<string, map<int, double>>& index, const map<int, int>& id_to_rating,
+                             const vector<string_view>& words) {
+    map<int, double> potential_documents;
+    for (const string_view word_view : words) {
+        const string word(word_view);
+        if (index.count(word)) {
+            for (auto [id, tf] : index.at(word)) {
+                potential_documents[id] += tf * log(id_to_rating.size() * 1.0 / index.at(word).size());
+            }
+        }
+    }
+    vector<Document> matched_documents;
+    for (const auto& [id, relevance] : potential_documents) {
+        matched_documents.push_back({ id, relevance, id_to_rating.at(id) });
+    }
+    sort(matched_documents.begin(), matched_documents.end(),
+        [](const Document& lhs, const Document& rhs) {
+            return lhs.relevance > rhs.relevance ||
+                (abs(lhs.relevance - rhs.relevance) < EPSILON && lhs.rating > rhs.rating);
+        });
+    return min(matched_documents.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+}
+
+// -------- Бенчмарки ----------
+
+void BenchmarkInvertedIndex(int document_count) {
+    mt19937 generator(42);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    const int document_length = 10;
+    const int query_count = 100;
+
+    SearchServer server("and in at"s);
+    map<string, map<int, double>> nested_index;
+    map<int, int> id_to_rating;
+
+    vector<string> documents;
+    documents.reserve(document_count);
+    for (int id = 0; id < document_count; ++id) {
+        documents.push_back(GenerateText(generator, dictionary, document_length));
+    }
+
+    const double add_seconds = MeasureSeconds([&] {
+        for (int id = 0; id < document_count; ++id) {
+            server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    });
+    cout << "AddDocument x "s << document_count << ": "s << add_seconds << " s"s << endl;
+
+    for (int id = 0; id < document_count; ++id) {
+        const auto words = SplitIntoWords(documents[id]);
+        map<string, int> freqs;
+        for (const auto& word : words) {
+            ++freqs[string(word)];
+        }
+        for (const auto& [word, freq] : freqs) {
+            nested_index[word][id] = freq * 1.0 / words.size();
+        }
+        id_to_rating[id] = 2;
+    }
+    documents.clear();
+
+    vector<string> queries;
+    for (int i = 0; i < query_count; ++i) {
+        queries.push_back(GenerateText(generator, dictionary, 10));
+    }
+
+    size_t found = 0;
+    const double flat_seconds = MeasureSeconds([&] {
+        for (const auto& query : queries) {
+            found += server.FindTopDocuments(query).size();
+        }
+    });
+
+    size_t nested_found = 0;
+    const double nested_seconds = MeasureSeconds([&] {
+        for (const auto& query : queries) {
+            nested_found += FindTopWithNestedMaps(nested_index, id_to_rating, SplitIntoWords(query));
+        }
+    });
+
+    cout << "FindTopDocuments x "s << query_count << " (flat postings): "s << flat_seconds << " s"s << endl;
+    cout << "FindTopDocuments x "s << query_count << " (map<string, map<int, double>>): "s << nested_seconds << " s"s << endl;
+    cout << "Speedup: "s << nested_seconds / flat_seconds << "x"s << endl;
+    cout << "(found "s << found << " / "s << nested_found << ")"s << endl;
+}
+
+//память posting list и время поиска до и после CompressPostings. Бюджет: сжатый индекс ищет не более чем в 2 раза медленнее
+void BenchmarkCompressedPostings(int document_count) {
+    mt19937 generator(11);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    SearchServer server("and in at"s);
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, GenerateText(generator, dictionary, 10), DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        queries.push_back(GenerateText(generator, dictionary, 10));
+    }
+    const auto run_queries = [&] {
+        size_t found = 0;
+        for (const auto& query : queries) {
+            found += server.FindTopDocuments(query).size();
+        }
+        return found;
+    };
+
+    const size_t plain_bytes = server.GetPostingsMemoryUsage();
+    const double plain_seconds = MeasureSeconds(run_queries);
+    server.CompressPostings();
+    const size_t compressed_bytes = server.GetPostingsMemoryUsage();
+    const double compressed_seconds = MeasureSeconds(run_queries);
+
+    cout << "Postings memory: "s << plain_bytes << " -> "s << compressed_bytes << " bytes ("s
+        << plain_bytes * 1.0 / compressed_bytes << "x smaller)"s << endl;
+    cout << "FindTopDocuments x "s << queries.size() << ": "s << plain_seconds << " s -> "s << compressed_seconds << " s"s
+        << (compressed_seconds <= 2 * plain_seconds ? " (within 2x budget)"s : " (OVER 2x budget)"s) << endl;
+}
+
+//перестроение индекса через AddDocument против загрузки снимка через LoadIndex
+void BenchmarkSnapshot(int document_count) {
+    mt19937 generator(13);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    vector<string> documents;
+    for (int id = 0; id < document_count; ++id) {
+        documents.push_back(GenerateText(generator, dictionary, 10));
+    }
+
+    SearchServer server("and in at"s);
+    const double build_seconds = MeasureSeconds([&] {
+        for (int id = 0; id < document_count; ++id) {
+            server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    });
+    const string path = "search_server_benchmark_index.bin"s;
+    const double save_seconds = MeasureSeconds([&] {
+        server.SaveIndex(path);
+    });
+    int loaded_count = 0;
+    const double load_seconds = MeasureSeconds([&] {
+        loaded_count = SearchServer::LoadIndex(path).GetDocumentCount();
+    });
+    remove(path.c_str());
+
+    cout << "Rebuild with AddDocument: "s << build_seconds << " s, SaveIndex: "s << save_seconds
+        << " s, LoadIndex: "s << load_seconds << " s ("s << loaded_count << " documents)"s << endl;
+}
+
+//построение индекса: AddDocument по одному против AddDocuments с частичными индексами
+void BenchmarkParallelBuild(int document_count) {
+    mt19937 generator(19);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    vector<string> texts;
+    for (int id = 0; id < document_count; ++id) {
+        texts.push_back(GenerateText(generator, dictionary, 10));
+    }
+    vector<RawDocument> documents;
+    for (int id = 0; id < document_count; ++id) {
+        documents.push_back({ id, texts[id], DocumentStatus::ACTUAL, { 1, 2, 3 } });
+    }
+
+    SearchServer sequential("and in at"s);
+    const double sequential_seconds = MeasureSeconds([&] {
+        for (const RawDocument& document : documents) {
+            sequential.AddDocument(document.id, document.text, document.status, document.ratings);
+        }
+    });
+    SearchServer parallel("and in at"s);
+    const double parallel_seconds = MeasureSeconds([&] {
+        parallel.AddDocuments(execution::par, documents);
+    });
+
+    cout << "Build index, AddDocument: "s << sequential_seconds << " s, AddDocuments(par): "s << parallel_seconds
+        << " s ("s << thread::hardware_concurrency() << " threads)"s << endl;
+}
+
+//обращения к аллокатору на один документ и один запрос: SearchServer с пулом индекса и временной памятью запроса
+//против старой раскладки map<string, map<int, double>> с map на каждый запрос
+void BenchmarkAllocations(int document_count) {
+    mt19937 generator(23);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    vector<string> documents;
+    for (int id = 0; id < document_count; ++id) {
+        documents.push_back(GenerateText(generator, dictionary, 10));
+    }
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        queries.push_back(GenerateText(generator, dictionary, 10));
+    }
+
+    SearchServer server("and in at"s);
+    const size_t add_allocations = CountAllocations([&] {
+        for (int id = 0; id < document_count; ++id) {
+            server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    });
+    server.FindTopDocuments(queries[0]);
+    const size_t query_allocations = CountAllocations([&] {
+        for (const auto& query : queries) {
+            server.FindTopDocuments(query);
+        }
+    });
+
+    map<string, map<int, double>> nested_index;
+    map<int, int> id_to_rating;
+    const size_t nested_add_allocations = CountAllocations([&] {
+        for (int id = 0; id < document_count; ++id) {
+            const auto words = SplitIntoWords(documents[id]);
+            map<string, int> freqs;
+            for (const auto& word : words) {
+                ++freqs[string(word)];
+            }
+            for (const auto& [word, freq] : freqs) {
+                nested_index[word][id] = freq * 1.0 / words.size();
+            }
+            id_to_rating[id] = 2;
+        }
+    });
+    const size_t nested_query_allocations = CountAllocations([&] {
+        for (const auto& query : queries) {
+            FindTopWithNestedMaps(nested_index, id_to_rating, SplitIntoWords(query));
+        }
+    });
+
+    cout << "Allocations per AddDocument: "s << add_allocations * 1.0 / document_count << " (nested maps: "s
+        << nested_add_allocations * 1.0 / document_count << ")"s << endl;
+    cout << "Allocations per FindTopDocuments: "s << query_allocations * 1.0 / queries.size() << " (nested maps: "s
+        << nested_query_allocations * 1.0 / queries.size() << ")"s << endl;
+}
+
+//разбор входного файла: построчно через iostream (как в старом CreateSearchServer) против BulkReader,
+//и полная загрузка через CreateSearchServer с пакетным AddDocuments
+void BenchmarkBulkLoader(int document_count) {
+    mt19937 generator(17);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    const string path = "search_server_benchmark_input.txt"s;
+    {
+        ofstream out(path);
+        out << "and in at\n"s << document_count << '\n';
+        for (int id = 0; id < document_count; ++id) {
+            out << GenerateText(generator, dictionary, 10) << "\n3 1 2 3\n"s;
+        }
+    }
+
+    size_t checksum = 0;
+    const double iostream_seconds = MeasureSeconds([&] {
+        ifstream in(path);
+        string line;
+        getline(in, line);
+        int count = 0;
+        in >> count;
+        getline(in, line);
+        for (int id = 0; id < count; ++id) {
+            getline(in, line);
+            checksum += line.size();
+            int ratings_size = 0;
+            in >> ratings_size;
+            vector<int> ratings(ratings_size);
+            for (int& rating : ratings) {
+                in >> rating;
+            }
+            getline(in, line);
+        }
+    });
+    const double bulk_seconds = MeasureSeconds([&] {
+        BulkReader input(path);
+        input.ReadLine();
+        const int count = input.ReadLineWithNumber();
+        for (int id = 0; id < count; ++id) {
+            checksum += input.ReadLine().size();
+            string_view ratings_line = input.ReadLine();
+            vector<int> ratings(BulkReader::ParseNumber(ratings_line));
+            for (int& rating : ratings) {
+                rating = BulkReader::ParseNumber(ratings_line);
+            }
+        }
+    });
+    int loaded_count = 0;
+    const double load_seconds = MeasureSeconds([&] {
+        BulkReader input(path);
+        loaded_count = CreateSearchServer(input).GetDocumentCount();
+    });
+    remove(path.c_str());
+
+    cout << "Parse input, iostream: "s << document_count / iostream_seconds << " docs/s, BulkReader: "s
+        << document_count / bulk_seconds << " docs/s"s << endl;
+    cout << "CreateSearchServer (BulkReader + AddDocuments): "s << loaded_count / load_seconds << " docs/s"s << endl;
+}
+
+//запросы с обязательными словами: пересечение posting list против полного подсчета по всем плюс-словам
+//с проверкой обязательных слов в фильтре, как пришлось бы делать без +слов
+void BenchmarkRequiredWords(int document_count) {
+    mt19937 generator(37);
+    const ZipfWordGenerator words(GenerateDictionary(generator, 20000, 10), 1.0);
+    SearchServer server(BENCHMARK_STOP_WORDS);
+    CorpusOptions options;
+    options.document_count = document_count;
+    const auto documents = GenerateCorpus(generator, words, options);
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    vector<pair<string, string>> queries;
+    for (int i = 0; i < 200; ++i) {
+        const string first = words(generator);
+        const string second = words(generator);
+        const string third = words(generator);
+        queries.push_back({ "+"s + first + " +"s + second + " "s + third, first + " "s + second + " "s + third });
+    }
+
+    size_t found = 0;
+    const double intersection_seconds = MeasureSeconds([&] {
+        for (const auto& [required_query, _] : queries) {
+            found += server.FindTopDocuments(required_query).size();
+        }
+    });
+    size_t exhaustive_found = 0;
+    const double exhaustive_seconds = MeasureSeconds([&] {
+        for (const auto& [required_query, plain_query] : queries) {
+            const auto required_words = SplitIntoWords(required_query);
+            exhaustive_found += server.FindTopDocuments(plain_query, [&](int document_id, DocumentStatus, int) {
+                const auto& word_freqs = server.GetWordFrequencies(document_id);
+                return word_freqs.count(required_words[0].substr(1)) && word_freqs.count(required_words[1].substr(1));
+            }).size();
+        }
+    });
+    cout << "Required words, "s << queries.size() << " queries: intersection "s << intersection_seconds
+        << " s, full scoring + filter "s << exhaustive_seconds << " s"s
+        << (found == exhaustive_found ? ""s : " (result mismatch)"s) << endl;
+}
+
+//отбор top-5 с отсечением MaxScore против плотного обхода всех posting list; плотный обход включается
+//запросом с top_k больше PRUNING_MAX_TOP_K, из результата берутся первые документы
+void BenchmarkPruning(int document_count) {
+    mt19937 generator(41);
+    const ZipfWordGenerator words(GenerateDictionary(generator, 20000, 10), 1.0);
+    SearchServer server(BENCHMARK_STOP_WORDS);
+    CorpusOptions options;
+    options.document_count = document_count;
+    const auto documents = GenerateCorpus(generator, words, options);
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, { id % 10 });
+    }
+    vector<string> queries;
+    for (int i = 0; i < 500; ++i) {
+        string query;
+        for (int j = 0; j < 4; ++j) {
+            query += words(generator) + " "s;
+        }
+        queries.push_back(query);
+    }
+
+    for (const bool compress : { false, true }) {
+        if (compress) {
+            server.CompressPostings();
+        }
+        vector<vector<Document>> pruned_results;
+        const double pruned_seconds = MeasureSeconds([&] {
+            for (const string& query : queries) {
+                pruned_results.push_back(server.FindTopDocuments(query));
+            }
+        });
+        bool same = true;
+        const double dense_seconds = MeasureSeconds([&] {
+            for (size_t i = 0; i < queries.size(); ++i) {
+                const auto found_docs = server.FindTopDocuments(queries[i], DocumentStatus::ACTUAL, PRUNING_MAX_TOP_K + 1);
+                for (size_t j = 0; j < pruned_results[i].size(); ++j) {
+                    same = same && found_docs.size() > j && found_docs[j].id == pruned_results[i][j].id;
+                }
+            }
+        });
+        cout << "Top-5 of "s << queries.size() << " queries"s << (compress ? " (compressed)"s : ""s)
+            << ": MaxScore "s << pruned_seconds << " s, dense scan "s << dense_seconds << " s"s
+            << (same ? ""s : " (result mismatch)"s) << endl;
+    }
+}
+
+//разбиение текста на слова: прежний побайтовый цикл, разметка блоков без SIMD и выбранная для процессора
+void BenchmarkTokenizer(int document_count) {
+    mt19937 generator(43);
+    const ZipfWordGenerator words(GenerateDictionary(generator, 20000, 10), 1.0);
+    CorpusOptions options;
+    options.document_count = document_count;
+    const auto documents = GenerateCorpus(generator, words, options);
+    size_t total_size = 0;
+    for (const string& document : documents) {
+        total_size += document.size();
+    }
+
+    vector<string_view> tokens;
+    size_t byte_loop_count = 0;
+    const double byte_loop_seconds = MeasureSeconds([&] {
+        for (const string& document : documents) {
+            tokens.clear();
+            size_t word_begin = 0;
+            for (size_t i = 0; i < document.size(); ++i) {
+                const char c = document[i];
+                if (c == ' ') {
+                    if (i > word_begin) {
+                        tokens.push_back(string_view(document).substr(word_begin, i - word_begin));
+                    }
+                    word_begin = i + 1;
+                }
+                else if (c >= FIRST_SPECIAL_SYMBOL && c <= LAST_SPECIAL_SYMBOL) {
+                    throw invalid_argument("Invalid char in query/stop words");
+                }
+            }
+            if (word_begin < document.size()) {
+                tokens.push_back(string_view(document).substr(word_begin));
+            }
+            byte_loop_count += tokens.size();
+        }
+    });
+    const auto measure = [&](ScanBlockFunc scan_block, size_t& count) {
+        return MeasureSeconds([&] {
+            for (const string& document : documents) {
+                tokens.clear();
+                SplitIntoWords(document, tokens, scan_block);
+                count += tokens.size();
+            }
+        });
+    };
+    size_t scalar_count = 0;
+    const double scalar_seconds = measure(ScanBlockScalar, scalar_count);
+    size_t simd_count = 0;
+    const double simd_seconds = measure(GetScanBlock(), simd_count);
+
+    const double megabytes = total_size / 1e6;
+    cout << "Tokenize "s << megabytes << " MB: byte loop "s << megabytes / byte_loop_seconds << " MB/s, scalar blocks "s
+        << megabytes / scalar_seconds << " MB/s, "s << (GetScanBlock() == ScanBlockScalar ? "scalar"s : "SIMD"s)
+        << " blocks "s << megabytes / simd_seconds << " MB/s"s
+        << (byte_loop_count == scalar_count && scalar_count == simd_count ? ""s : " (result mismatch)"s) << endl;
+
+    //длинные тексты, как при загрузке больших документов, где блоки заполнены целиком
+    string long_text;
+    for (size_t i = 0; i < documents.size() && long_text.size() < (1u << 24); ++i) {
+        long_text += documents[i] + " "s;
+    }
+    tokens.clear();
+    const double long_scalar_seconds = MeasureSeconds([&] {
+        SplitIntoWords(long_text, tokens, ScanBlockScalar);
+    });
+    tokens.clear();
+    const double long_simd_seconds = MeasureSeconds([&] {
+        SplitIntoWords(long_text, tokens);
+    });
+    cout << "Tokenize one "s << long_text.size() / 1e6 << " MB text: scalar blocks "s << long_text.size() / 1e6 / long_scalar_seconds
+        << " MB/s, selected "s << long_text.size() / 1e6 / long_simd_seconds << " MB/s"s << endl;
+}
+
+//поток запросов через RequestQueue из одного потока и из пула execution::par
+void BenchmarkRequestQueue(int request_count) {
+    SearchServer server("and in at"s);
+    server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    vector<string> queries(request_count, "curly"s);
+    for (size_t i = 0; i < queries.size(); i += 3) {
+        queries[i] = "empty request"s;
+    }
+
+    RequestQueue sequential_queue(server);
+    const double sequential_seconds = MeasureSeconds([&] {
+        for (const string& query : queries) {
+            sequential_queue.AddFindRequest(query);
+        }
+    });
+    RequestQueue parallel_queue(server);
+    const double parallel_seconds = MeasureSeconds([&] {
+        for_each(execution::par, queries.begin(), queries.end(), [&parallel_queue](const string& query) {
+            parallel_queue.AddFindRequest(query);
+        });
+    });
+    cout << "RequestQueue::AddFindRequest, 1 thread: "s << request_count / sequential_seconds << " req/s, par: "s
+        << request_count / parallel_seconds << " req/s (empty "s << parallel_queue.GetNoResultRequests()
+        << ", hit rate "s << parallel_queue.GetHitRate() << ")"s << endl;
+}
+
+//поток с повторяющимися популярными запросами (распределение Ципфа) без кэша и через QueryResultCache
+void BenchmarkQueryResultCache(int document_count) {
+    mt19937 generator(29);
+    const auto dictionary = GenerateDictionary(generator, 20000, 10);
+    SearchServer server("and in at"s);
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, GenerateText(generator, dictionary, 10), DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    vector<string> distinct_queries;
+    vector<double> weights;
+    for (int i = 0; i < 1000; ++i) {
+        distinct_queries.push_back(GenerateText(generator, dictionary, 3));
+        weights.push_back(1.0 / (i + 1));
+    }
+    discrete_distribution<int> popularity(weights.begin(), weights.end());
+    vector<string> queries;
+    for (int i = 0; i < 2000; ++i) {
+        queries.push_back(distinct_queries[popularity(generator)]);
+    }
+
+    size_t found = 0;
+    const double plain_seconds = MeasureSeconds([&] {
+        for (const string& query : queries) {
+            found += server.FindTopDocuments(query).size();
+        }
+    });
+    QueryResultCache cache(server, 256);
+    size_t cached_found = 0;
+    const double cached_seconds = MeasureSeconds([&] {
+        for (const string& query : queries) {
+            cached_found += cache.FindTopDocuments(query).size();
+        }
+    });
+    cout << "FindTopDocuments x "s << queries.size() << " (Zipf): "s << plain_seconds << " s, with QueryResultCache(256): "s
+        << cached_seconds << " s, hit rate "s << cache.GetHitRate() << (found == cached_found ? ""s : " (result mismatch)"s) << endl;
+}
+
+//накопление релевантности по длинным posting list: обычный map в одном потоке, ConcurrentMap с разным числом
+//частей под execution::par и плотные массивы по кускам номеров, как в FindTopDocuments(execution::par)
+void BenchmarkConcurrentMap(int document_count) {
+    mt19937 generator(7);
+    const int word_count = 10;
+    vector<vector<pair<int, double>>> posting_lists(word_count);
+    for (auto& postings : posting_lists) {
+        for (int id = 0; id < document_count; ++id) {
+            if (uniform_int_distribution(0, 1)(generator)) {
+                postings.push_back({ id, uniform_real_distribution(0.0, 1.0)(generator) });
+            }
+        }
+    }
+
+    double checksum = 0;
+    const double plain_seconds = MeasureSeconds([&] {
+        map<int, double> documents;
+        for (const auto& postings : posting_lists) {
+            for (const auto& [id, tf] : postings) {
+                documents[id] += tf;
+            }
+        }
+        checksum = documents.size();
+    });
+    cout << "map<int, double>, "s << word_count << " lists x "s << document_count / 2 << " postings: "s << plain_seconds << " s"s << endl;
+
+    for (const size_t bucket_count : { 1, 4, 16, 64, 256, 1024 }) {
+        size_t size = 0;
+        const double concurrent_seconds = MeasureSeconds([&] {
+            ConcurrentMap<int, double> documents(bucket_count);
+            for (const auto& postings : posting_lists) {
+                for_each(execution::par, postings.begin(), postings.end(), [&documents](const pair<int, double>& posting) {
+                    documents[posting.first].ref_to_value += posting.second;
+                });
+            }
+            size = documents.BuildOrdinaryMap().size();
+        });
+        cout << "ConcurrentMap, "s << bucket_count << " buckets: "s << concurrent_seconds << " s"s
+            << (size == checksum ? ""s : " (size mismatch)"s) << endl;
+    }
+
+    const size_t chunk_count = max(1u, thread::hardware_concurrency()) * 4;
+    size_t size = 0;
+    const double chunked_seconds = MeasureSeconds([&] {
+        vector<size_t> chunk_sizes(chunk_count);
+        vector<size_t> chunks(chunk_count);
+        iota(chunks.begin(), chunks.end(), 0);
+        for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+            const int first = static_cast<int>(chunk * document_count / chunk_count);
+            const int last = static_cast<int>((chunk + 1) * document_count / chunk_count);
+            vector<double> relevance(last - first);
+            vector<char> matched(last - first);
+            for (const auto& postings : posting_lists) {
+                auto it = lower_bound(postings.begin(), postings.end(), make_pair(first, 0.0));
+                for (; it != postings.end() && it->first < last; ++it) {
+                    relevance[it->first - first] += it->second;
+                    matched[it->first - first] = 1;
+                }
+            }
+            chunk_sizes[chunk] = count(matched.begin(), matched.end(), 1);
+        });
+        size = accumulate(chunk_sizes.begin(), chunk_sizes.end(), size_t(0));
+    });
+    cout << "Dense arrays, "s << chunk_count << " chunks: "s << chunked_seconds << " s"s
+        << (size == checksum ? ""s : " (size mismatch)"s) << endl;
+}
+
+// -------- Горячие пути SearchServer на корпусе с распределением Ципфа ----------
+
+void RunSearchServerSuite(const BenchmarkRunner& runner, const CorpusOptions& options) {
+    mt19937 generator(31);
+    const ZipfWordGenerator words(GenerateDictionary(generator, options.vocabulary_size, 10), options.zipf_exponent);
+    const auto documents = GenerateCorpus(generator, words, options);
+    const auto queries = GenerateQueries(generator, words, QueryMix(), 1000);
+    const auto plus_queries = GenerateQueries(generator, words, { 3, 0.0, 0.0 }, 1000);
+    const auto long_queries = GenerateQueries(generator, words, { 10, 0.2, 0.1 }, 1000);
+    const auto required_queries = GenerateQueries(generator, words, { 3, 0.0, 0.0, 0.7 }, 1000);
+
+    cout << "Corpus: "s << options.document_count << " documents x "s << options.document_length << " words, vocabulary "s
+        << options.vocabulary_size << ", Zipf exponent "s << options.zipf_exponent << endl;
+    BenchmarkState::PrintHeader();
+
+    runner.Run("AddDocument"s, [&](BenchmarkState& state) {
+        SearchServer server(BENCHMARK_STOP_WORDS);
+        while (state.KeepRunning()) {
+            const int id = static_cast<int>(state.GetIteration());
+            server.AddDocument(id, documents[id % documents.size()], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+    });
+
+    SearchServer server(BENCHMARK_STOP_WORDS);
+    for (size_t id = 0; id < documents.size(); ++id) {
+        server.AddDocument(static_cast<int>(id), documents[id], static_cast<DocumentStatus>(id % 4), { static_cast<int>(id % 10) });
+    }
+
+    const auto run_queries = [&](const string& name, const vector<string>& query_set, auto search) {
+        runner.Run(name, [&](BenchmarkState& state) {
+            while (state.KeepRunning()) {
+                search(query_set[state.GetIteration() % query_set.size()]);
+            }
+        });
+    };
+    run_queries("FindTopDocuments/plus"s, plus_queries, [&](const string& query) {
+        return server.FindTopDocuments(query);
+    });
+    run_queries("FindTopDocuments/mix"s, queries, [&](const string& query) {
+        return server.FindTopDocuments(query);
+    });
+    run_queries("FindTopDocuments/long"s, long_queries, [&](const string& query) {
+        return server.FindTopDocuments(query);
+    });
+    run_queries("FindTopDocuments/required"s, required_queries, [&](const string& query) {
+        return server.FindTopDocuments(query);
+    });
+    run_queries("FindTopDocuments/predicate"s, queries, [&](const string& query) {
+        return server.FindTopDocuments(query, [](int document_id, DocumentStatus, int rating) {
+            return document_id % 2 == 0 && rating > 2;
+        });
+    });
+    run_queries("FindTopDocuments/par"s, queries, [&](const string& query) {
+        return server.FindTopDocuments(execution::par, query);
+    });
+    run_queries("MatchDocument"s, queries, [&](const string& query) {
+        return server.MatchDocument(query, static_cast<int>(query.size() * 7919 % documents.size()));
+    });
+    run_queries("MatchDocument/par"s, queries, [&](const string& query) {
+        return server.MatchDocument(execution::par, query, static_cast<int>(query.size() * 7919 % documents.size()));
+    });
+
+    runner.Run("ProcessQueries/100"s, [&](BenchmarkState& state) {
+        const vector<string> batch(queries.begin(), queries.begin() + 100);
+        state.SetItemsPerIteration(batch.size());
+        while (state.KeepRunning()) {
+            ProcessQueries(server, batch);
+        }
+    });
+
+    RequestQueue request_queue(server);
+    run_queries("RequestQueue::AddFindRequest"s, queries, [&](const string& query) {
+        return request_queue.AddFindRequest(query);
+    });
+    QueryResultCache cache(server);
+    RequestQueue cached_request_queue(cache);
+    run_queries("RequestQueue::AddFindRequest/cache"s, queries, [&](const string& query) {
+        return cached_request_queue.AddFindRequest(query);
+    });
+
+#ifdef SEARCH_SERVER_PROFILE
+    cout << "Query stages over all FindTopDocuments above:"s << endl;
+    server.GetQueryProfile().Print(cout);
+#endif
+}
+
+//SearchServerBenchmark [количество документов] [фильтр по имени]; сборка и запуск - make benchmark BENCHMARK_ARGS="..."
+int main(int argc, char* argv[]) {
+    CorpusOptions options;
+    options.document_count = argc > 1 ? atoi(argv[1]) : 1'000'000;
+    BenchmarkRunner runner;
+    runner.filter = argc > 2 ? argv[2] : ""s;
+
+    RunSearchServerSuite(runner, options);
+
+    //сравнения с прежними реализациями, каждое печатает свой отчет
+    const int document_count = options.document_count;
+    const vector<pair<string, void (*)(int)>> comparisons = {
+        { "Compare/InvertedIndex"s, BenchmarkInvertedIndex },
+        { "Compare/CompressedPostings"s, BenchmarkCompressedPostings },
+        { "Compare/Snapshot"s, BenchmarkSnapshot },
+        { "Compare/ParallelBuild"s, BenchmarkParallelBuild },
+        { "Compare/Allocations"s, BenchmarkAllocations },
+        { "Compare/BulkLoader"s, BenchmarkBulkLoader },
+        { "Compare/ConcurrentMap"s, BenchmarkConcurrentMap },
+        { "Compare/RequestQueue"s, BenchmarkRequestQueue },
+        { "Compare/QueryResultCache"s, BenchmarkQueryResultCache },
+        { "Compare/RequiredWords"s, BenchmarkRequiredWords },
+        { "Compare/Pruning"s, BenchmarkPruning },
+        { "Compare/Tokenizer"s, BenchmarkTokenizer },
+    };
+    for (const auto& [name, benchmark] : comparisons) {
+        if (runner.IsSelected(name)) {
+            cout << "-- "s << name << endl;
+            benchmark(document_count);
+        }
+    }
+}
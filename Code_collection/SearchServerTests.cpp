@@ -1,10 +1,18 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <map>
+#include <numeric>
+#include <random>
 #include <set>
 #include <string>
+#include <thread>
 #include <utility>
+#include <sstream>
 #include <vector>
+//замеры этапов поиска включаются флагом сборки -DSEARCH_SERVER_PROFILE, make test гоняет тесты с ним и без него
+#define SEARCH_SERVER_NO_MAIN
 #include "SearchServer.cpp"
 
 using namespace std;
@@ -236,6 +244,946 @@ void TestPredicateFilters() {
     }
 }
 
+void TestParallelFindTopDocuments() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "white cat and fashionable collar"s, DocumentStatus::ACTUAL, {8, -3});
+    server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+    server.AddDocument(4, "groomed starling eugene"s, DocumentStatus::BANNED, {9});
+    server.AddDocument(5, "fluffy dog with collar"s, DocumentStatus::ACTUAL, {1, 2});
+    {
+        const string query = "fluffy groomed cat collar -tail"s;
+        const auto sequential = server.FindTopDocuments(query);
+        const auto parallel = server.FindTopDocuments(execution::par, query);
+        ASSERT_EQUAL(sequential.size(), parallel.size());
+        for (size_t i = 0; i < sequential.size(); ++i) {
+            ASSERT_EQUAL(sequential[i].id, parallel[i].id);
+            ASSERT(abs(sequential[i].relevance - parallel[i].relevance) < 1e-6);
+        }
+    }
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par, "groomed"s, DocumentStatus::BANNED).size(), 1u);
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par_unseq, "groomed"s, DocumentStatus::BANNED).size(), 1u);
+    server.AddDocuments(execution::par_unseq, { { 6, "groomed cat", DocumentStatus::ACTUAL, {} } });
+    ASSERT_EQUAL(get<0>(server.MatchDocument(execution::par_unseq, "groomed cat"s, 6)).size(), 2u);
+    server.RemoveDocument(execution::par_unseq, 6);
+    ASSERT_EQUAL(server.GetDocumentCount(), 5);
+
+    //номера делятся на куски, и posting list в несколько блоков сжатого представления режутся по их границам
+    const vector<string> words = { "cat"s, "dog"s, "fluffy"s, "collar"s, "tail"s, "eyes"s, "rat"s };
+    for (const bool compress : { false, true }) {
+        SearchServer large_server("and with"s);
+        if (compress) {
+            large_server.CompressPostings();
+        }
+        for (int id = 0; id < 1000; ++id) {
+            large_server.AddDocument(id, words[id % 7] + " "s + words[id % 5] + " "s + words[id % 3], DocumentStatus::ACTUAL, { id % 10 });
+        }
+        for (int id = 0; id < 1000; id += 9) {
+            large_server.RemoveDocument(id);
+        }
+        for (const string& query : { "cat"s, "fluffy -dog"s, "cat dog tail -rat"s, "eyes collar -cat -dog"s }) {
+            const auto sequential = large_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 1000);
+            const auto parallel = large_server.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL, 1000);
+            ASSERT_EQUAL(sequential.size(), parallel.size());
+            for (size_t i = 0; i < sequential.size(); ++i) {
+                ASSERT_EQUAL(sequential[i].id, parallel[i].id);
+                ASSERT(abs(sequential[i].relevance - parallel[i].relevance) < 1e-6);
+            }
+        }
+    }
+}
+
+void TestProcessQueries() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(3, "big cat nasty hair"s, DocumentStatus::ACTUAL, {1, 2, 8});
+    const vector<string> queries = {"nasty rat -not"s, "not very funny nasty pet"s, "curly hair"s, "unknown"s};
+
+    const auto results = ProcessQueries(server, queries);
+    ASSERT_EQUAL(results.size(), queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto expected = server.FindTopDocuments(queries[i]);
+        ASSERT_EQUAL(results[i].size(), expected.size());
+        for (size_t j = 0; j < expected.size(); ++j) {
+            ASSERT_EQUAL(results[i][j].id, expected[j].id);
+        }
+    }
+
+    const auto joined = ProcessQueriesJoined(server, queries);
+    ASSERT_EQUAL(joined.size(), results[0].size() + results[1].size() + results[2].size() + results[3].size());
+    ASSERT_EQUAL(joined.front().id, results[0].front().id);
+}
+
+void TestTopKSelection() {
+    SearchServer server("and"s);
+    for (int id = 0; id < 20; ++id) {
+        server.AddDocument(id, "cat"s + string(id, ' ') + " dog"s + (id % 3 == 0 ? " cat"s : ""s), DocumentStatus::ACTUAL, {id});
+        server.AddDocument(100 + id, "dog"s, DocumentStatus::ACTUAL, {id});
+    }
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s).size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 12).size(), 12u);
+    ASSERT(server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 0).empty());
+
+    const auto top = server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 20);
+    ASSERT_EQUAL(top.size(), 20u);
+    for (size_t i = 1; i < top.size(); ++i) {
+        ASSERT(top[i - 1].relevance > top[i].relevance - 1e-6);
+    }
+    //документы с повтором "cat" релевантнее, при равной релевантности выше рейтинг
+    ASSERT_EQUAL(top[0].id, 18);
+    ASSERT_EQUAL(top[7].id, 19);
+
+    const auto even = server.FindTopDocuments("cat"s, [](int document_id, DocumentStatus status, int rating) {
+        return document_id % 2 == 0;
+    }, 3);
+    ASSERT_EQUAL(even.size(), 3u);
+    ASSERT_EQUAL(even[0].id, 18);
+    ASSERT_EQUAL(even[1].id, 12);
+}
+
+void TestStringViewQueries() {
+    SearchServer server("and in"s);
+    {
+        //индекс хранит свои копии слов, текст документа можно освободить сразу после добавления
+        string content = "cat in the city and cat"s;
+        server.AddDocument(1, content, DocumentStatus::ACTUAL, {1});
+        content.assign(content.size(), 'x');
+    }
+    server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    const string_view query = "  cat   city cat  -dog "sv;
+    const auto found_docs = server.FindTopDocuments(query);
+    ASSERT_EQUAL(found_docs.size(), 1u);
+    ASSERT_EQUAL(found_docs[0].id, 1);
+    ASSERT_EQUAL(get<0>(server.MatchDocument(query, 1)).size(), 2u);
+    ASSERT_EQUAL(SplitIntoWords("  a  bb c "sv).size(), 3u);
+}
+
+void TestRemoveDocument() {
+    const auto make_server = [](const vector<int>& ids) {
+        SearchServer server("and with"s);
+        const vector<string> texts = {"funny pet and nasty rat"s, "funny pet with curly hair"s,
+                                      "nasty rat with curly hair"s, "big cat nasty hair"s};
+        for (const int id : ids) {
+            server.AddDocument(id, texts[id - 1], DocumentStatus::ACTUAL, {id});
+        }
+        return server;
+    };
+    const string query = "curly nasty cat"s;
+
+    SearchServer server = make_server({1, 2, 3, 4});
+    server.RemoveDocument(3);
+    server.RemoveDocument(42);
+    ASSERT_EQUAL(server.GetDocumentCount(), 3);
+    ASSERT_EQUAL(server.GetDocumentId(2), 4);
+
+    //после удаления релевантность (IDF) такая же, как если бы документа не было вовсе
+    const auto expected = make_server({1, 2, 4}).FindTopDocuments(query);
+    const auto found_docs = server.FindTopDocuments(query);
+    ASSERT_EQUAL(found_docs.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQUAL(found_docs[i].id, expected[i].id);
+        ASSERT(abs(found_docs[i].relevance - expected[i].relevance) < 1e-6);
+    }
+
+    server.RemoveDocument(execution::par, 4);
+    ASSERT(server.FindTopDocuments("cat"s).empty());
+    server.RemoveDocuments(execution::par, {1, 2, 1});
+    ASSERT_EQUAL(server.GetDocumentCount(), 0);
+    ASSERT(server.FindTopDocuments(query).empty());
+
+    server.AddDocument(3, "curly cat"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(server.FindTopDocuments(query).size(), 1u);
+
+    //id перечисляются в порядке добавления и после удалений вперемешку с добавлениями
+    SearchServer ordered_server = make_server({4, 2, 1, 3});
+    ASSERT(vector<int>(ordered_server.begin(), ordered_server.end()) == vector<int>({4, 2, 1, 3}));
+    ordered_server.RemoveDocument(2);
+    ordered_server.AddDocument(7, "curly cat"s, DocumentStatus::ACTUAL, {1});
+    ordered_server.RemoveDocument(1);
+    ASSERT(vector<int>(ordered_server.begin(), ordered_server.end()) == vector<int>({4, 3, 7}));
+    ASSERT_EQUAL(ordered_server.GetDocumentId(1), 3);
+    ordered_server.AddDocument(2, "funny pet"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(ordered_server.GetDocumentId(3), 2);
+}
+
+void TestGetWordFrequencies() {
+    SearchServer server("and"s);
+    server.AddDocument(1, "cat and dog and cat"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    const SearchServer::WordFrequencies& word_freqs = server.GetWordFrequencies(1);
+    ASSERT_EQUAL(word_freqs.size(), 2u);
+    ASSERT(abs(word_freqs.at("cat"sv) - 2.0 / 3) < 1e-6);
+    ASSERT(abs(word_freqs.at("dog"sv) - 1.0 / 3) < 1e-6);
+    ASSERT(server.GetWordFrequencies(42).empty());
+
+    server.RemoveDocument(1);
+    ASSERT(server.GetWordFrequencies(1).empty());
+    ASSERT_EQUAL(server.GetWordFrequencies(2).size(), 1u);
+}
+
+void TestParallelMatchDocument() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::BANNED, {1, 2});
+
+    vector<string_view> matched_words;
+    {
+        //результат ссылается на слова индекса, а не на строку запроса
+        const string query = "rat pet curly funny nasty"s;
+        matched_words = get<0>(server.MatchDocument(execution::par, query, 1));
+        ASSERT_EQUAL(get<0>(server.MatchDocument(query, 1)).size(), 4u);
+    }
+    const vector<string_view> expected = {"funny"sv, "nasty"sv, "pet"sv, "rat"sv};
+    ASSERT(matched_words == expected);
+
+    const auto [words, status] = server.MatchDocument(execution::par, "curly -hair pet"s, 2);
+    ASSERT(words.empty());
+    ASSERT(status == DocumentStatus::BANNED);
+    ASSERT(get<0>(server.MatchDocument(execution::seq, "curly -hair pet"s, 2)).empty());
+}
+
+void TestRemoveDuplicates() {
+    SearchServer server("and with"s);
+    server.AddDocument(5, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(1, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(3, "funny funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(4, "nasty rat funny pet"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(6, "pet curly"s, DocumentStatus::ACTUAL, {1, 2});
+    server.AddDocument(7, "pet with curly"s, DocumentStatus::ACTUAL, {1, 2});
+
+    const vector<int> expected_duplicates = {2, 3, 5, 7};
+    ASSERT(RemoveDuplicates(server) == expected_duplicates);
+    ASSERT_EQUAL(server.GetDocumentCount(), 3);
+    const vector<int> remaining(server.begin(), server.end());
+    const vector<int> expected = {1, 4, 6};
+    ASSERT(remaining == expected);
+}
+
+void TestCompressedPostings() {
+    CompressedPostingList posting_list;
+    for (int ordinal = 0; ordinal < 1000; ordinal += 3) {
+        posting_list.PushBack(ordinal, ordinal % 7 + 1);
+    }
+    ASSERT_EQUAL(posting_list.size(), 334u);
+    ASSERT_EQUAL(posting_list.BlockCount(), 3u);
+    CompressedPostingList::Cursor cursor(posting_list);
+    cursor.SkipTo(400);
+    ASSERT_EQUAL(cursor.Ordinal(), 402);
+    ASSERT_EQUAL(cursor.Count(), 402 % 7 + 1);
+    cursor.Next();
+    ASSERT_EQUAL(cursor.Ordinal(), 405);
+    cursor.SkipTo(998);
+    ASSERT_EQUAL(cursor.Ordinal(), 999);
+    cursor.SkipTo(1000);
+    ASSERT(cursor.AtEnd());
+
+    const auto make_server = [] {
+        SearchServer server("and with"s);
+        server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+        server.AddDocument(2, "funny pet with curly hair hair"s, DocumentStatus::ACTUAL, {1, 2});
+        server.AddDocument(3, "big cat nasty hair"s, DocumentStatus::ACTUAL, {1, 2, 8});
+        return server;
+    };
+    SearchServer plain = make_server();
+    SearchServer compressed = make_server();
+    compressed.CompressPostings();
+    ASSERT(compressed.IsPostingsCompressed());
+    for (auto* server : {&plain, &compressed}) {
+        server->AddDocument(4, "nasty curly cat"s, DocumentStatus::ACTUAL, {5});
+        server->RemoveDocument(2);
+    }
+    for (const string& query : {"nasty hair -rat"s, "curly cat funny"s}) {
+        const auto expected = plain.FindTopDocuments(query);
+        for (const auto& found_docs : {compressed.FindTopDocuments(query), compressed.FindTopDocuments(execution::par, query)}) {
+            ASSERT_EQUAL(found_docs.size(), expected.size());
+            for (size_t i = 0; i < expected.size(); ++i) {
+                ASSERT_EQUAL(found_docs[i].id, expected[i].id);
+                ASSERT(abs(found_docs[i].relevance - expected[i].relevance) < 1e-12);
+            }
+        }
+    }
+}
+
+void TestSaveLoadIndex() {
+    const string path = "search_server_test_index.bin"s;
+    for (const bool compress : {false, true}) {
+        SearchServer server("and with"s);
+        server.AddDocument(5, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+        server.AddDocument(1, "funny pet with curly hair hair"s, DocumentStatus::BANNED, {1, 2});
+        server.AddDocument(3, "big cat nasty hair"s, DocumentStatus::ACTUAL, {1, 2, 8});
+        server.AddDocument(7, "curly cat"s, DocumentStatus::ACTUAL, {4});
+        server.RemoveDocument(3);
+        if (compress) {
+            server.CompressPostings();
+        }
+        server.SaveIndex(path);
+
+        const SearchServer loaded = SearchServer::LoadIndex(path);
+        ASSERT_EQUAL(loaded.IsPostingsCompressed(), compress);
+        ASSERT_EQUAL(loaded.GetDocumentCount(), server.GetDocumentCount());
+        for (int i = 0; i < loaded.GetDocumentCount(); ++i) {
+            ASSERT_EQUAL(loaded.GetDocumentId(i), server.GetDocumentId(i));
+        }
+        for (const string& query : {"nasty hair -rat"s, "curly cat funny with"s}) {
+            const auto expected = server.FindTopDocuments(query);
+            const auto found_docs = loaded.FindTopDocuments(query);
+            ASSERT_EQUAL(found_docs.size(), expected.size());
+            for (size_t i = 0; i < expected.size(); ++i) {
+                ASSERT_EQUAL(found_docs[i].id, expected[i].id);
+                ASSERT_EQUAL(found_docs[i].relevance, expected[i].relevance);
+                ASSERT_EQUAL(found_docs[i].rating, expected[i].rating);
+            }
+        }
+        const auto [words, status] = loaded.MatchDocument("curly hair funny"s, 1);
+        ASSERT_EQUAL(words.size(), 3u);
+        ASSERT(status == DocumentStatus::BANNED);
+        ASSERT(loaded.GetWordFrequencies(3).empty());
+        ASSERT(abs(loaded.GetWordFrequencies(1).at("hair"sv) - 0.4) < 1e-12);
+    }
+    remove(path.c_str());
+
+    try {
+        SearchServer::LoadIndex("search_server_missing_index.bin"s);
+        ASSERT_HINT(false, "Loading a missing snapshot must throw"s);
+    } catch (const runtime_error&) {
+    }
+}
+
+//испорченный снимок должен отвергаться исключением invalid_argument, а не читаться за пределами данных
+void TestCorruptedSnapshot() {
+    const string path = "search_server_test_corrupted.bin"s;
+    const string corrupted_path = "search_server_test_corrupted_copy.bin"s;
+    SearchServer server("and with"s);
+    for (int id = 0; id < 300; ++id) {
+        server.AddDocument(id, id % 2 ? "funny pet and nasty rat"s : "curly cat with curly hair"s, DocumentStatus::ACTUAL, { id });
+    }
+    server.CompressPostings();
+    server.SaveIndex(path);
+
+    string snapshot;
+    {
+        ifstream in(path, ios::binary);
+        snapshot.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    const auto load = [&corrupted_path](const string& data) {
+        {
+            ofstream out(corrupted_path, ios::binary);
+            out.write(data.data(), data.size());
+        }
+        try {
+            const SearchServer loaded = SearchServer::LoadIndex(corrupted_path);
+            loaded.FindTopDocuments("curly nasty cat"s);
+            return true;
+        }
+        catch (const invalid_argument&) {
+            return false;
+        }
+    };
+    ASSERT(load(snapshot));
+    //каждый байт по очереди: снимок либо читается, либо отвергается
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        string corrupted = snapshot;
+        corrupted[i] = static_cast<char>(~corrupted[i]);
+        load(corrupted);
+    }
+    for (size_t size = 0; size < snapshot.size(); size += 7) {
+        ASSERT(!load(snapshot.substr(0, size)));
+    }
+    //смещение второго блока последнего списка ("rat", 150 записей по 2 байта без одного) за пределы его байт.
+    //В конце снимка: заголовки блоков {first, last, offset, size} по 16 байт, длина байт списка и сами байты
+    const size_t rat_bytes = 150 * 2 - 2;
+    const size_t second_block_offset = snapshot.size() - rat_bytes - sizeof(uint64_t) - 16 + 2 * sizeof(int);
+    uint32_t offset = 0;
+    memcpy(&offset, snapshot.data() + second_block_offset, sizeof(offset));
+    ASSERT_EQUAL(offset, CompressedPostingList::BLOCK_SIZE * 2 - 1);
+    string corrupted = snapshot;
+    offset = 0x7FFFFFF0;
+    memcpy(corrupted.data() + second_block_offset, &offset, sizeof(offset));
+    ASSERT(!load(corrupted));
+
+    //вектор метаданных в снимке: размер uint64 и значения подряд
+    const auto vector_bytes = [](const vector<int>& values) {
+        const uint64_t size = values.size();
+        string result(reinterpret_cast<const char*>(&size), sizeof(size));
+        result.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(int));
+        return result;
+    };
+    //статусы: 300 документов ACTUAL, значение вне DocumentStatus
+    const size_t statuses_offset = snapshot.find(vector_bytes(vector<int>(300, 0)));
+    ASSERT(statuses_offset != string::npos);
+    corrupted = snapshot;
+    const int invalid_status = static_cast<int>(DocumentStatus::REMOVED) + 1;
+    memcpy(corrupted.data() + statuses_offset + sizeof(uint64_t), &invalid_status, sizeof(invalid_status));
+    ASSERT(!load(corrupted));
+    //id документов идут последними из двух одинаковых векторов 0..299 (перед ними ordinal_to_id_), меняются местами 0 и 1
+    vector<int> ids(300);
+    iota(ids.begin(), ids.end(), 0);
+    const size_t document_ids_offset = snapshot.rfind(vector_bytes(ids));
+    ASSERT(document_ids_offset > snapshot.find(vector_bytes(ids)));
+    corrupted = snapshot;
+    swap(ids[0], ids[1]);
+    memcpy(corrupted.data() + document_ids_offset + sizeof(uint64_t), ids.data(), 2 * sizeof(int));
+    ASSERT(!load(corrupted));
+    remove(path.c_str());
+    remove(corrupted_path.c_str());
+}
+
+void TestBulkLoader() {
+    const string input = "and with\r\n3\nfunny pet and nasty rat\n3 7 2 7\nfunny pet with curly hair\n2 1 2\n"s
+                         "big cat nasty hair\n3 1 2 8\ncurly cat\n"s;
+    const string path = "search_server_test_input.txt"s;
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(input.data(), 1, input.size(), file);
+        fclose(file);
+    }
+
+    BulkReader file_input(path);
+    const SearchServer server = CreateSearchServer(file_input, 2);
+    ASSERT_EQUAL(server.GetDocumentCount(), 3);
+    ASSERT_EQUAL(server.GetDocumentId(2), 2);
+    const auto found_docs = server.FindTopDocuments("nasty"s);
+    ASSERT_EQUAL(found_docs.size(), 2u);
+    ASSERT_EQUAL(found_docs[0].id, 0);
+    ASSERT_EQUAL(found_docs[0].rating, (7 + 2 + 7) / 3);
+    ASSERT(server.FindTopDocuments("and"s).empty());
+    ASSERT_EQUAL(file_input.ReadLine(), "curly cat"sv);
+    ASSERT(file_input.AtEnd());
+
+    FILE* file = fopen(path.c_str(), "rb");
+    BulkReader stream_input(file);
+    ASSERT_EQUAL(CreateSearchServer(stream_input).GetDocumentCount(), 3);
+    fclose(file);
+
+    //куски меньше строки: строки собираются из нескольких кусков, старые куски освобождаются между пачками
+    for (const size_t chunk_size : { size_t(1), size_t(5), size_t(16) }) {
+        file = fopen(path.c_str(), "rb");
+        BulkReader small_chunks_input(file, chunk_size);
+        const SearchServer small_chunks_server = CreateSearchServer(small_chunks_input, 1);
+        ASSERT_EQUAL(small_chunks_server.GetDocumentCount(), 3);
+        ASSERT_EQUAL(small_chunks_server.FindTopDocuments("nasty"s).size(), 2u);
+        ASSERT_EQUAL(small_chunks_input.ReadLine(), "curly cat"sv);
+        ASSERT(small_chunks_input.AtEnd());
+        fclose(file);
+    }
+    remove(path.c_str());
+
+    //число оценок не должно быть отрицательным или больше, чем помещается в строку
+    for (const string& ratings_line : { "-1"s, "3 1 2"s, "1000000000 1"s, "2 12"s }) {
+        const string bad_input = "\n1\ncat\n"s + ratings_line + "\n"s;
+        FILE* bad_file = fmemopen(const_cast<char*>(bad_input.data()), bad_input.size(), "rb");
+        BulkReader bad_reader(bad_file);
+        try {
+            CreateSearchServer(bad_reader);
+            ASSERT_HINT(false, "Invalid ratings count must throw: "s + ratings_line);
+        }
+        catch (const invalid_argument&) {
+        }
+        fclose(bad_file);
+    }
+}
+
+void TestParallelAddDocuments() {
+    const vector<string> texts = { "funny pet and nasty rat"s, "funny pet with curly hair"s, "big cat nasty hair"s,
+                                   "nasty dog with big eyes"s, "funny funny pet"s, "and with"s, "curly cat curly tail"s };
+    vector<RawDocument> documents;
+    SearchServer expected("and with"s);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const int id = static_cast<int>(i * 10 + 5);
+        documents.push_back({ id, texts[i], DocumentStatus::ACTUAL, { static_cast<int>(i), 3 } });
+        expected.AddDocument(id, texts[i], DocumentStatus::ACTUAL, { static_cast<int>(i), 3 });
+    }
+
+    SearchServer compressed("and with"s);
+    compressed.CompressPostings();
+    compressed.AddDocuments(execution::par, documents);
+    ASSERT_EQUAL(compressed.FindTopDocuments("funny nasty"s).size(), expected.FindTopDocuments("funny nasty"s).size());
+
+    SearchServer server("and with"s);
+    server.AddDocuments(execution::par, documents);
+    ASSERT_EQUAL(server.GetDocumentCount(), expected.GetDocumentCount());
+    for (int index = 0; index < server.GetDocumentCount(); ++index) {
+        const int id = server.GetDocumentId(index);
+        ASSERT_EQUAL(id, expected.GetDocumentId(index));
+        ASSERT(server.GetWordFrequencies(id) == expected.GetWordFrequencies(id));
+    }
+    for (const string& query : { "funny nasty"s, "curly -dog"s, "big hair pet"s }) {
+        const auto found = server.FindTopDocuments(query);
+        const auto expected_found = expected.FindTopDocuments(query);
+        ASSERT_EQUAL(found.size(), expected_found.size());
+        for (size_t i = 0; i < found.size(); ++i) {
+            ASSERT_EQUAL(found[i].id, expected_found[i].id);
+            ASSERT(abs(found[i].relevance - expected_found[i].relevance) < EPSILON);
+        }
+    }
+
+    //как и при последовательном добавлении, документы до ошибочного остаются в индексе
+    const vector<RawDocument> with_duplicate = { { 100, "white cat", DocumentStatus::ACTUAL, {} },
+                                                 { 101, "black dog", DocumentStatus::ACTUAL, {} },
+                                                 { 5, "funny rat", DocumentStatus::ACTUAL, {} },
+                                                 { 102, "grey parrot", DocumentStatus::ACTUAL, {} } };
+    try {
+        server.AddDocuments(execution::par, with_duplicate);
+        ASSERT_HINT(false, "Duplicate id must throw"s);
+    }
+    catch (const invalid_argument&) {
+    }
+    ASSERT_EQUAL(server.GetDocumentCount(), static_cast<int>(texts.size()) + 2);
+    ASSERT_EQUAL(server.FindTopDocuments("dog"s).size(), 2u);
+    ASSERT(server.FindTopDocuments("parrot"s).empty());
+
+    const vector<RawDocument> with_invalid_text = { { 200, "green frog", DocumentStatus::ACTUAL, {} },
+                                                    { 201, "red fo\x12x", DocumentStatus::ACTUAL, {} } };
+    try {
+        server.AddDocuments(execution::par, with_invalid_text);
+        ASSERT_HINT(false, "Invalid char must throw"s);
+    }
+    catch (const invalid_argument&) {
+    }
+    ASSERT_EQUAL(server.FindTopDocuments("frog"s).size(), 1u);
+    ASSERT(server.FindTopDocuments("red"s).empty());
+}
+
+//временные массивы запроса переиспользуются, следующий запрос не должен видеть результат предыдущего
+void TestQueryScratchReuse() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "white cat and fancy collar"s, DocumentStatus::ACTUAL, { 8, -3 });
+    server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
+    const auto expected = server.FindTopDocuments("fluffy groomed cat"s);
+
+    ASSERT_EQUAL(server.FindTopDocuments("cat -fluffy"s).size(), 1u);
+    //большой top_k - отбор через плотные массивы, а не через отсечение
+    ASSERT_EQUAL(server.FindTopDocuments("cat -fluffy"s, DocumentStatus::ACTUAL, PRUNING_MAX_TOP_K + 1).size(), 1u);
+    for (const size_t top_k : { size_t(MAX_RESULT_DOCUMENT_COUNT), PRUNING_MAX_TOP_K + 1 }) {
+        try {
+            server.FindTopDocuments("fluffy groomed cat"s, [](int document_id, DocumentStatus, int) -> bool {
+                throw out_of_range("filter "s + to_string(document_id));
+                }, top_k);
+            ASSERT_HINT(false, "Filter exception must be rethrown"s);
+        }
+        catch (const out_of_range&) {
+        }
+    }
+
+    SearchServer small_server(""s);
+    small_server.AddDocument(7, "cat"s, DocumentStatus::ACTUAL, { 1 });
+    small_server.AddDocument(8, "dog"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(small_server.FindTopDocuments("cat"s).size(), 1u);
+
+    for (const size_t top_k : { size_t(MAX_RESULT_DOCUMENT_COUNT), PRUNING_MAX_TOP_K + 1 }) {
+        const auto found = server.FindTopDocuments("fluffy groomed cat"s, DocumentStatus::ACTUAL, top_k);
+        ASSERT_EQUAL(found.size(), expected.size());
+        for (size_t i = 0; i < found.size(); ++i) {
+            ASSERT_EQUAL(found[i].id, expected[i].id);
+            ASSERT(abs(found[i].relevance - expected[i].relevance) < EPSILON);
+        }
+    }
+}
+
+//после удаления большей части документов номера перенумеровываются, результат не должен меняться
+void TestOrdinalCompaction() {
+    const string path = "search_server_test_compaction.bin"s;
+    const string fresh_path = "search_server_test_compaction_fresh.bin"s;
+    const vector<string> texts = { "white cat and fancy collar"s, "fluffy cat fluffy tail"s, "groomed dog expressive eyes"s,
+                                   "groomed starling eugene"s, "fluffy dog with collar"s };
+    const auto file_size = [](const string& file_path) {
+        ifstream in(file_path, ios::binary | ios::ate);
+        return static_cast<size_t>(in.tellg());
+    };
+    for (const bool compress : { false, true }) {
+        SearchServer server("and with"s);
+        SearchServer fresh_server("and with"s);
+        vector<int> removed_ids;
+        for (int id = 0; id < 100; ++id) {
+            server.AddDocument(id, texts[id % texts.size()], DocumentStatus::ACTUAL, { id % 7 });
+            if (id % 9 == 0) {
+                fresh_server.AddDocument(id, texts[id % texts.size()], DocumentStatus::ACTUAL, { id % 7 });
+            }
+            else {
+                removed_ids.push_back(id);
+            }
+        }
+        if (compress) {
+            server.CompressPostings();
+            fresh_server.CompressPostings();
+        }
+        server.RemoveDocuments(execution::seq, removed_ids);
+
+        //пустых номеров не осталось: снимок такой же, как у индекса, собранного только из живых документов
+        server.SaveIndex(path);
+        fresh_server.SaveIndex(fresh_path);
+        ASSERT_EQUAL(file_size(path), file_size(fresh_path));
+
+        for (const string& query : { "fluffy groomed cat -tail"s, "collar dog"s, "eugene"s }) {
+            for (const size_t top_k : { size_t(MAX_RESULT_DOCUMENT_COUNT), PRUNING_MAX_TOP_K + 1 }) {
+                const auto found_docs = server.FindTopDocuments(query, DocumentStatus::ACTUAL, top_k);
+                const auto expected = fresh_server.FindTopDocuments(query, DocumentStatus::ACTUAL, top_k);
+                ASSERT_EQUAL(found_docs.size(), expected.size());
+                for (size_t i = 0; i < expected.size(); ++i) {
+                    ASSERT_EQUAL(found_docs[i].id, expected[i].id);
+                    ASSERT_EQUAL(found_docs[i].relevance, expected[i].relevance);
+                }
+            }
+        }
+        const auto [words, status] = server.MatchDocument("fluffy tail dog"s, 9);
+        ASSERT_EQUAL(words.size(), 2u);
+        ASSERT_EQUAL(server.GetWordFrequencies(18).size(), 3u);
+
+        server.AddDocument(200, "fluffy parrot"s, DocumentStatus::ACTUAL, { 1 });
+        ASSERT_EQUAL(server.FindTopDocuments("parrot"s).at(0).id, 200);
+        ASSERT_EQUAL(SearchServer::LoadIndex(path).FindTopDocuments("eugene"s).size(), 2u);
+    }
+    remove(path.c_str());
+    remove(fresh_path.c_str());
+}
+
+void TestRequestQueueStats() {
+    SearchServer server("and in at"s);
+    server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    server.AddDocument(3, "big cat fancy collar "s, DocumentStatus::ACTUAL, { 1, 2, 8 });
+
+    //окно 3 секунды по секунде, время двигает сам тест
+    RequestQueue::Clock::time_point now;
+    RequestQueue request_queue(server, chrono::seconds(3), chrono::seconds(1), [&now] {
+        return now;
+        });
+    ASSERT_EQUAL(request_queue.GetRequestCount(), 0u);
+    request_queue.AddFindRequest("empty request"s);
+    now += chrono::seconds(1);
+    request_queue.AddFindRequest("curly"s);
+    request_queue.AddFindRequest("curly"s);
+    now += chrono::milliseconds(1500);
+    request_queue.AddFindRequest("fancy collar"s, [](int document_id, DocumentStatus, int) {
+        return document_id == 3;
+        });
+    ASSERT_EQUAL(request_queue.GetRequestCount(), 4u);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+    ASSERT(abs(request_queue.GetAverageResultSize() - (0 + 2 + 2 + 1) / 4.0) < 1e-9);
+    ASSERT_EQUAL(request_queue.GetRequestCount(chrono::seconds(1)), 1u);
+    //3 запроса за прошлую секунду и половину текущей
+    ASSERT(abs(request_queue.GetQueriesPerSecond(chrono::seconds(2)) - 3 / 1.5) < 1e-9);
+    ASSERT(abs(request_queue.GetQueriesPerSecond() - 4 / 2.5) < 1e-9);
+
+    //первая секунда с пустым запросом выпадает из окна
+    now += chrono::seconds(1);
+    request_queue.AddFindRequest("cat"s, DocumentStatus::BANNED);
+    ASSERT_EQUAL(request_queue.GetRequestCount(), 4u);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+    ASSERT(abs(request_queue.GetHitRate() - 3.0 / 4) < 1e-9);
+    //через окно без запросов статистика пустая
+    now += chrono::seconds(10);
+    ASSERT_EQUAL(request_queue.GetRequestCount(), 0u);
+    ASSERT_EQUAL(request_queue.GetHitRate(), 0.0);
+
+    //окно по умолчанию - сутки, но очередь живет всего секунду: скорость считается за эту секунду
+    RequestQueue::Clock::time_point young_now;
+    RequestQueue young_queue(server, chrono::hours(24), chrono::minutes(1), [&young_now] {
+        return young_now;
+        });
+    ASSERT_EQUAL(young_queue.GetQueriesPerSecond(), 0.0);
+    for (int i = 0; i < 10; ++i) {
+        young_now += chrono::milliseconds(100);
+        young_queue.AddFindRequest("curly"s);
+    }
+    ASSERT(abs(young_queue.GetQueriesPerSecond() - 10.0) < 1e-9);
+
+    RequestQueue concurrent_queue(server);
+    vector<string> queries(1000, "curly"s);
+    for (size_t i = 0; i < queries.size(); i += 4) {
+        queries[i] = "parrot"s;
+    }
+    for_each(execution::par, queries.begin(), queries.end(), [&concurrent_queue](const string& query) {
+        concurrent_queue.AddFindRequest(query);
+        });
+    ASSERT_EQUAL(concurrent_queue.GetRequestCount(), 1000u);
+    ASSERT_EQUAL(concurrent_queue.GetNoResultRequests(), 250);
+    ASSERT(abs(concurrent_queue.GetAverageResultSize() - 750 * 2.0 / 1000) < 1e-9);
+}
+
+void TestQueryResultCache() {
+    SearchServer server("and in at"s);
+    server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    server.AddDocument(3, "big cat fancy collar "s, DocumentStatus::BANNED, { 1, 2, 8 });
+    ASSERT_EQUAL(server.NormalizeQuery("dog in cat -collar cat"s), "cat dog -collar "s);
+
+    QueryResultCache cache(server, 2, 1);
+    ASSERT_EQUAL(cache.FindTopDocuments("curly cat"s).size(), 2u);
+    //тот же нормализованный запрос - попадание
+    ASSERT_EQUAL(cache.FindTopDocuments("cat and curly curly"s).size(), 2u);
+    ASSERT_EQUAL(cache.GetHitCount(), 1u);
+    ASSERT_EQUAL(cache.GetMissCount(), 1u);
+    //статус - часть ключа
+    ASSERT_EQUAL(cache.FindTopDocuments("curly cat"s, DocumentStatus::BANNED).size(), 1u);
+    ASSERT_EQUAL(cache.GetMissCount(), 2u);
+
+    //вытесняется самая давно использованная запись
+    cache.FindTopDocuments("curly cat"s);
+    cache.FindTopDocuments("collar"s);
+    ASSERT_EQUAL(cache.GetHitCount(), 2u);
+    cache.FindTopDocuments("curly cat"s);
+    ASSERT_EQUAL(cache.GetHitCount(), 3u);
+    cache.FindTopDocuments("curly cat"s, DocumentStatus::BANNED);
+    ASSERT_EQUAL(cache.GetHitCount(), 3u);
+
+    //изменение индекса делает записи устаревшими
+    server.AddDocument(4, "curly parrot"s, DocumentStatus::ACTUAL, { 5 });
+    ASSERT_EQUAL(cache.FindTopDocuments("curly cat"s).size(), 3u);
+    server.RemoveDocument(1);
+    ASSERT_EQUAL(cache.FindTopDocuments("curly cat"s).size(), 2u);
+    ASSERT_EQUAL(cache.GetHitCount(), 3u);
+
+    RequestQueue request_queue(cache);
+    request_queue.AddFindRequest("cat curly"s);
+    request_queue.AddFindRequest("empty request"s);
+    ASSERT_EQUAL(cache.GetHitCount(), 4u);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+}
+
+void TestProfiling() {
+    ostringstream log;
+    {
+        LOG_DURATION_STREAM("Build index"s, log);
+    }
+    ASSERT_EQUAL(log.str().substr(0, 13), "Build index: "s);
+    ASSERT(log.str().find(" ms\n"s) != string::npos);
+
+    DurationHistogram histogram;
+    histogram.Add(chrono::nanoseconds(100));
+    histogram.Add(chrono::nanoseconds(150));
+    histogram.Add(chrono::microseconds(5));
+    ASSERT_EQUAL(histogram.GetCount(), 3u);
+    ASSERT_EQUAL(histogram.GetTotal().count(), 5250);
+    ASSERT_EQUAL(histogram.GetPercentile(0.5).count(), 256);
+    ASSERT_EQUAL(histogram.GetPercentile(1.0).count(), 8192);
+
+    SearchServer server("and in at"s);
+    server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    ASSERT_EQUAL(server.FindTopDocuments("curly -dog"s).size(), 1u);
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par, "curly cat"s).size(), 2u);
+#ifdef SEARCH_SERVER_PROFILE
+    const auto& profile = server.GetQueryProfile();
+    for (const auto stage : { QueryStage::PARSE, QueryStage::SCORE, QueryStage::SORT }) {
+        ASSERT_EQUAL(profile[stage].GetCount(), 2u);
+    }
+    //последовательный запрос с небольшим top_k фильтрует документы прямо при отсечении
+    ASSERT_EQUAL(profile[QueryStage::FILTER].GetCount(), 1u);
+    ostringstream report;
+    profile.Print(report);
+    ASSERT(report.str().find("score: count 2"s) != string::npos);
+    server.ResetQueryProfile();
+    ASSERT_EQUAL(profile[QueryStage::SCORE].GetCount(), 0u);
+#endif
+}
+
+void TestBooleanQueries() {
+    SearchServer server("and in at"s);
+    server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    server.AddDocument(3, "big cat fancy collar"s, DocumentStatus::ACTUAL, { 1, 2, 8 });
+    server.AddDocument(4, "big dog sparrow"s, DocumentStatus::ACTUAL, { 1, 3, 2 });
+    for (int id = 10; id < 300; ++id) {
+        server.AddDocument(id, id % 3 == 0 ? "fancy parrot"s : "grey parrot"s, DocumentStatus::ACTUAL, { id });
+    }
+
+    const auto ids = [](const vector<Document>& documents) {
+        vector<int> result;
+        for (const Document& document : documents) {
+            result.push_back(document.id);
+        }
+        return result;
+    };
+    ASSERT(ids(server.FindTopDocuments("+fancy +collar"s)) == vector<int>({ 3, 2 }));
+    ASSERT(ids(server.FindTopDocuments("+fancy +collar -dog"s)) == vector<int>({ 3 }));
+    ASSERT(ids(server.FindTopDocuments("\"collar fancy\" big"s)) == vector<int>({ 3, 2 }));
+    ASSERT(ids(server.FindTopDocuments("\"big\" curly"s)) == vector<int>({ 4, 3 }));
+    ASSERT(server.FindTopDocuments("+fancy +unicorn"s).empty());
+    //стоп-слова в обязательных словах и фразах пропускаются
+    ASSERT_EQUAL(server.FindTopDocuments("+and +sparrow"s).size(), 1u);
+    ASSERT_EQUAL(server.FindTopDocuments("\"fancy and parrot\""s, DocumentStatus::ACTUAL, 1000).size(), 96u);
+
+    //релевантность та же, что у обычного запроса с теми же плюс-словами
+    const auto required = server.FindTopDocuments("+fancy curly cat"s);
+    const auto plain = server.FindTopDocuments("fancy curly cat"s, [](int document_id, DocumentStatus, int) {
+        return document_id == 2 || document_id == 3 || (document_id >= 10 && document_id % 3 == 0);
+        });
+    ASSERT_EQUAL(required.size(), plain.size());
+    for (size_t i = 0; i < required.size(); ++i) {
+        ASSERT_EQUAL(required[i].id, plain[i].id);
+        ASSERT_EQUAL(required[i].relevance, plain[i].relevance);
+    }
+    server.CompressPostings();
+    ASSERT(ids(server.FindTopDocuments("+fancy curly cat"s)) == ids(required));
+    ASSERT(ids(server.FindTopDocuments(execution::par, "+fancy +collar -dog"s)) == vector<int>({ 3 }));
+
+    const auto [words, status] = server.MatchDocument("+cat curly"s, 2);
+    ASSERT(words.empty());
+    ASSERT_EQUAL(get<0>(server.MatchDocument("\"cat tail\" curly"s, 1)).size(), 3u);
+    ASSERT(server.NormalizeQuery("+cat dog"s) != server.NormalizeQuery("cat dog"s));
+
+    for (const string& query : { "+"s, "++cat"s, "+-cat"s, "\"fancy cat"s }) {
+        try {
+            server.FindTopDocuments(query);
+            ASSERT_HINT(false, "Invalid query must throw: "s + query);
+        }
+        catch (const invalid_argument&) {
+        }
+    }
+}
+
+//отсечение MaxScore должно давать ровно тот же результат, что и полный подсчет параллельной версии
+void TestMaxScorePruning() {
+    const string path = "search_server_test_pruning.bin"s;
+    const vector<string> vocabulary = { "cat"s, "dog"s, "curly"s, "fancy"s, "collar"s, "tail"s, "big"s, "small"s,
+                                        "sparrow"s, "parrot"s, "hamster"s, "rat"s, "funny"s, "nasty"s, "pet"s, "hair"s };
+    mt19937 generator(7);
+    SearchServer server("and in at"s);
+    for (int id = 0; id < 600; ++id) {
+        //первые слова словаря встречаются заметно чаще последних
+        string text;
+        const int word_count = uniform_int_distribution<int>(1, 8)(generator);
+        for (int i = 0; i < word_count; ++i) {
+            const size_t word = min(uniform_int_distribution<size_t>(0, vocabulary.size() - 1)(generator),
+                                    uniform_int_distribution<size_t>(0, vocabulary.size() - 1)(generator));
+            text += vocabulary[word] + " "s;
+        }
+        const auto status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        server.AddDocument(id, text, status, { uniform_int_distribution<int>(-3, 3)(generator) });
+    }
+    for (int id = 0; id < 600; id += 11) {
+        server.RemoveDocument(id);
+    }
+
+    vector<string> queries;
+    for (int i = 0; i < 40; ++i) {
+        string query;
+        for (int j = 0; j < 4; ++j) {
+            const size_t word = uniform_int_distribution<size_t>(0, vocabulary.size() - 1)(generator);
+            query += (j == 3 && i % 2 == 0 ? "-"s : ""s) + vocabulary[word] + " "s;
+        }
+        queries.push_back(query);
+    }
+    const auto check = [&queries](const SearchServer& search_server) {
+        for (const string& query : queries) {
+            for (const size_t top_k : { size_t(1), size_t(5), size_t(50) }) {
+                const auto even = [](int document_id, DocumentStatus status, int rating) {
+                    return document_id % 2 == 0;
+                };
+                const auto same_documents = [](const vector<Document>& found_docs, const vector<Document>& expected) {
+                    ASSERT_EQUAL(found_docs.size(), expected.size());
+                    for (size_t i = 0; i < expected.size(); ++i) {
+                        ASSERT_EQUAL(found_docs[i].id, expected[i].id);
+                        ASSERT_EQUAL(found_docs[i].relevance, expected[i].relevance);
+                        ASSERT_EQUAL(found_docs[i].rating, expected[i].rating);
+                    }
+                };
+                same_documents(search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, top_k),
+                               search_server.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL, top_k));
+                same_documents(search_server.FindTopDocuments(query, even, top_k),
+                               search_server.FindTopDocuments(execution::par, query, even, top_k));
+            }
+        }
+    };
+    check(server);
+    server.CompressPostings();
+    check(server);
+    server.SaveIndex(path);
+    check(SearchServer::LoadIndex(path));
+    remove(path.c_str());
+}
+
+//SIMD-разметка должна давать те же слова и ошибки, что и побайтовая, в том числе на границах блоков
+void TestSimdTokenizer() {
+    const auto split_by_bytes = [](const string& text) {
+        vector<string> words;
+        string word;
+        for (const char c : text) {
+            if (c == ' ') {
+                if (!word.empty()) {
+                    words.push_back(word);
+                }
+                word.clear();
+            }
+            else {
+                word += c;
+            }
+        }
+        if (!word.empty()) {
+            words.push_back(word);
+        }
+        return words;
+    };
+    //буквы, пробелы и байты UTF-8 - у последних при знаковом char отрицательные значения
+    const string alphabet = "ab  \xd0\xb0~"s;
+    vector<ScanBlockFunc> scan_blocks = { ScanBlockScalar, GetScanBlock() };
+#ifdef SEARCH_SERVER_X86_SIMD
+    scan_blocks.push_back(ScanBlockSse2);
+#endif
+    mt19937 generator(11);
+    for (int i = 0; i < 300; ++i) {
+        string text;
+        const int length = uniform_int_distribution<int>(0, 3 * static_cast<int>(TOKENIZER_BLOCK_SIZE))(generator);
+        for (int j = 0; j < length; ++j) {
+            text += alphabet[uniform_int_distribution<size_t>(0, alphabet.size() - 1)(generator)];
+        }
+        const auto expected = split_by_bytes(text);
+        for (const ScanBlockFunc scan_block : scan_blocks) {
+            vector<string_view> words;
+            SplitIntoWords(text, words, scan_block);
+            ASSERT(vector<string>(words.begin(), words.end()) == expected);
+        }
+        ASSERT(!HasSpecialSymbol(text));
+    }
+
+    const string text(2 * TOKENIZER_BLOCK_SIZE + 10, 'a');
+    for (const size_t position : { size_t(0), TOKENIZER_BLOCK_SIZE - 1, TOKENIZER_BLOCK_SIZE, text.size() - 1 }) {
+        for (const char special : { '\0', '\t', '\x1f' }) {
+            string invalid_text = text;
+            invalid_text[position] = special;
+            ASSERT(HasSpecialSymbol(invalid_text));
+            try {
+                SplitIntoWords(invalid_text);
+                ASSERT_HINT(false, "Invalid char must throw"s);
+            }
+            catch (const invalid_argument&) {
+            }
+        }
+    }
+
+    try {
+        SearchServer server(vector<string>{ "and"s, "in"s, "a\x01t"s });
+        ASSERT_HINT(false, "Invalid stop word must throw"s);
+    }
+    catch (const invalid_argument& e) {
+        ASSERT_EQUAL(string(e.what()), "Invalid char in stop-words collection"s);
+    }
+}
+
+//запрос, которому подходят все документы: плотные массивы потока заполняются целиком.
+//Запускается в новом потоке, чтобы массивы были свежими и точно по размеру индекса, а не остались от прошлых тестов
+void TestDenseScratchAllDocumentsMatch() {
+    SearchServer server(""s);
+    server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "cat dog"s, DocumentStatus::ACTUAL, { 2 });
+    vector<Document> long_query_found;
+    vector<Document> large_top_found;
+    thread worker([&server, &long_query_found, &large_top_found] {
+        //больше PRUNING_MAX_PLUS_WORDS плюс-слов - отбор через плотные массивы
+        long_query_found = server.FindTopDocuments("cat dog a b c d e"s);
+        large_top_found = server.FindTopDocuments("cat dog"s, DocumentStatus::ACTUAL, PRUNING_MAX_TOP_K + 1);
+        });
+    worker.join();
+    ASSERT_EQUAL(long_query_found.size(), 2u);
+    ASSERT_EQUAL(large_top_found.size(), 2u);
+    ASSERT_EQUAL(long_query_found[0].id, 2);
+    ASSERT_EQUAL(large_top_found[1].id, 1);
+}
+
 // Функция TestSearchServer является точкой входа для запуска тестов
 void TestSearchServer() {
     RUN_TEST(TestAddDocument);
@@ -245,6 +1193,28 @@ void TestSearchServer() {
     RUN_TEST(TestRelevanceSort);
     RUN_TEST(TestRatingCalculations);
     RUN_TEST(TestPredicateFilters);
+    RUN_TEST(TestParallelFindTopDocuments);
+    RUN_TEST(TestProcessQueries);
+    RUN_TEST(TestTopKSelection);
+    RUN_TEST(TestStringViewQueries);
+    RUN_TEST(TestRemoveDocument);
+    RUN_TEST(TestGetWordFrequencies);
+    RUN_TEST(TestParallelMatchDocument);
+    RUN_TEST(TestRemoveDuplicates);
+    RUN_TEST(TestCompressedPostings);
+    RUN_TEST(TestSaveLoadIndex);
+    RUN_TEST(TestCorruptedSnapshot);
+    RUN_TEST(TestBulkLoader);
+    RUN_TEST(TestParallelAddDocuments);
+    RUN_TEST(TestQueryScratchReuse);
+    RUN_TEST(TestOrdinalCompaction);
+    RUN_TEST(TestDenseScratchAllDocumentsMatch);
+    RUN_TEST(TestRequestQueueStats);
+    RUN_TEST(TestQueryResultCache);
+    RUN_TEST(TestProfiling);
+    RUN_TEST(TestBooleanQueries);
+    RUN_TEST(TestMaxScorePruning);
+    RUN_TEST(TestSimdTokenizer);
 }
 
 // --------- Окончание модульных тестов поисковой системы -----------